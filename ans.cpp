@@ -5,13 +5,25 @@
 * The structure is a simple two level model which switches between models (adaptive or quasi-static) based on how complex the data is.
 * The first level handles encoding the exponent of the rank, second level handles the mantissa of all possible ranks.
 * The second level is either adaptive CDF coding or quasi-static coding selected by exponent context.
-* BWT -> Rank -> RLE0 -> bytewise rANS (two encodes per symbol for exp+mant models)
-* TODO: include an incompressible model, if the structure couldn't be compressed we partially decode it, store raw symbols instead, and mark a flag.
-* This speeds up decoding and reduces waste on incompressible inputs. The models are paused while reading raw symbols.
+* BWT -> Rank -> RLE0 -> bytewise rANS (two encodes per symbol for exp+mant models), the encoder runs RLE0 and the models as one pass
+* The static mode skips the models and codes the RLE0 symbols with a per-chunk tANS table instead, trading some ratio for decode speed.
+* Chunks which the models can't shrink by at least 1/64 (noise, already compressed payloads) are stored raw with a mode flag,
+* the decoder copies them instead of modelling noise.
 **********************************************/
 #include "ans.hpp"
 
-void Ans::ParallelAns::Load (Buffer _Input, Buffer _Output, Index _in_p, Index _out_p, Index _clen, Index _olen, Index _rlen, Index *_freqs)
+Ans::Ans(Arena *Scratch)
+{
+	Workspace = Scratch;
+	Leb = new Utils();
+}
+
+Ans::~Ans()
+{
+	delete Leb;
+}
+
+void Ans::ParallelAns::Load (Buffer _Input, Buffer _Output, Index _in_p, Index _out_p, Index _clen, Index _olen, Index _rlen, Index *_freqs, int *_norms, unsigned char *_work, int _mode)
 {
 	Input = _Input;
 	Output = _Output;
@@ -20,15 +32,25 @@ void Ans::ParallelAns::Load (Buffer _Input, Buffer _Output, Index _in_p, Index _
 	clen = _clen;
 	olen = _olen;
 	rlen = _rlen;
-	
-	freqs = (int*)malloc(256 * sizeof(int));
-	if(freqs == NULL) 
-		Error("Failed to alloc freq array!");
+	work = _work;
+	mode = _mode;
 	memcpy(&freqs[0], &_freqs[0], 256 * sizeof(int));
+	if(mode == ModeStatic)
+		memcpy(&norms[0], &_norms[0], TANS_SYMBOLS * sizeof(int));
 }
 
-void Ans::ParallelAns::Threaded_Decode()
+/**
+* The rANS symbols are expanded by rle0 as they are decoded, straight into the rank array,
+* inverse rank coding then writes the chunk to its place in the output. Returns false if the chunk is corrupt.
+*/
+bool Ans::ParallelAns::Threaded_Decode()
 {
+	if(mode == ModeRaw)
+	{
+		memcpy(&Output.block[out_p], &Input.block[in_p], olen);
+		return true;
+	}
+	
 	AdaptiveModel *ExpModel = new AdaptiveModel(MaxModels);
 	AdaptiveModel *MantPrime[ModelSwitchThreshold];
 	QuasiModel *MantSec[MaxModels - ModelSwitchThreshold];
@@ -43,160 +65,276 @@ void Ans::ParallelAns::Threaded_Decode()
 	for(int c = 0; c < (MaxModels - ModelSwitchThreshold); c++)
 		MantSec[c]->Reset();
 	
-	unsigned short *rlebuf = (unsigned short*)malloc(StackSize * sizeof(unsigned short)); if(rlebuf == NULL) Error("Couldn't allocate rle buffer!");
+	RLE rle0;
+	rle0.Begin(work, olen);
+	bool Valid = true;
 	
 	uint8_t *rans_begin = &Input.block[in_p];
-	uint8_t* ptr = rans_begin;
-	RansState R[4];
-	RansDecInit(&R[0], &ptr);
-	RansDecInit(&R[1], &ptr);
-	RansDecInit(&R[2], &ptr);
-	RansDecInit(&R[3], &ptr);
-	for(Index sptr = 0; sptr < rlen; sptr++)
+	if(mode == ModeLanes)
 	{
-		unsigned short e, m;
-		RansState X = R[0];
-		int range = RansDecGet(&X, ExpModel->ProbBits);
-		e = ExpModel->RangeToSym(range);
-		RansDecAdvance(&X, &ptr, ExpModel->SymToLow(e), ExpModel->SymToFreq(e), ExpModel->ProbBits);
-		ExpModel->Update(e);
-		R[0] = R[1];
-		R[1] = R[2];
-		R[2] = R[3];
-		R[3] = X;
+		uint8_t *ptr = rans_begin;
+		uint8_t *rans_end = rans_begin + clen;
+		uint32_t State[RANS_LANES], Low[RANS_LANES], Freq[RANS_LANES];
+		for(int l = 0; l < RANS_LANES; l++)
+			RansWordDecInit(&State[l], &ptr);
+		
+		// Every symbol takes two lanes (exponent then mantissa), a round decodes RANS_LANES / 2 symbols
+		RansLaneKernel Advance = SelectRansLaneKernel();
+		const Index Values = rlen * 2;
+		for(Index v = 0; v < Values; v += RANS_LANES)
+		{
+			int Count = ((Values - v) < RANS_LANES) ? (Values - v) : RANS_LANES;
+			for(int l = 0; l < Count; l += 2)
+			{
+				unsigned short e, m;
+				e = ExpModel->RangeToSym(State[l] & (ExpModel->ProbScale - 1));
+				Low[l] = ExpModel->SymToLow(e);
+				Freq[l] = ExpModel->SymToFreq(e);
+				ExpModel->Update(e);
+				
+				if(e < ModelSwitchThreshold)
+				{
+					m = MantPrime[e]->RangeToSym(State[l + 1] & (MantPrime[e]->ProbScale - 1));
+					Low[l + 1] = MantPrime[e]->SymToLow(m);
+					Freq[l + 1] = MantPrime[e]->SymToFreq(m);
+					MantPrime[e]->Update(m);
+				}
+				else
+				{
+					QuasiModel *Model = MantSec[e - ModelSwitchThreshold];
+					m = Model->RangeToSym(State[l + 1] & (Model->ProbScale - 1));
+					Low[l + 1] = Model->SymToLow(m);
+					Freq[l + 1] = Model->SymToFreq(m);
+					Model->Update(m);
+				}
+				rle0.Put(Exponent[e] + Mantissa[Exponent[e] + m]);
+			}
+			
+			if(Count == RANS_LANES && (rans_end - ptr) >= 16) // Vector kernels load 16 bytes ahead
+				Advance(State, Low, Freq, &ptr);
+			else
+				RansLanesAdvance(State, Low, Freq, &ptr, Count);
+		}
 		
-		X = R[0];
-		if(e < ModelSwitchThreshold) // Use adaptive model (best compression)
+		for(int l = 0; l < RANS_LANES; l++)
+			if(State[l] != RANS_WORD_L)
+				Valid = false;
+	}
+	else if(mode == ModeStatic)
+	{
+		TansDecoder *Dec = new TansDecoder;
+		if(Dec->Build(norms) && Dec->Begin(rans_begin, rans_begin + clen))
 		{
-			range = RansDecGet(&X, MantPrime[e]->ProbBits);
-			m = MantPrime[e]->RangeToSym(range);
-			RansDecAdvance(&X, &ptr, MantPrime[e]->SymToLow(m), MantPrime[e]->SymToFreq(m), MantPrime[e]->ProbBits);
-			MantPrime[e]->Update(m);
+			Index i = 0;
+			for(; i + 4 <= rlen; i += 4) // A refill holds four symbols, the states alternate
+			{
+				rle0.Put(Dec->Next(0));
+				rle0.Put(Dec->Next(1));
+				rle0.Put(Dec->Next(0));
+				rle0.Put(Dec->Next(1));
+				Dec->Reload();
+			}
+			for(; i < rlen; i++)
+			{
+				rle0.Put(Dec->Next(i % TANS_STATES));
+				Dec->Reload();
+			}
+			Valid = Dec->End();
 		}
-		else // Use quasi static model (much faster on complex distributions)
+		else
+			Valid = false;
+		delete Dec;
+	}
+	else
+	{
+		uint8_t* ptr = rans_begin;
+		RansState R[4];
+		RansDecInit(&R[0], &ptr);
+		RansDecInit(&R[1], &ptr);
+		RansDecInit(&R[2], &ptr);
+		RansDecInit(&R[3], &ptr);
+		for(Index sptr = 0; sptr < rlen; sptr++)
 		{
-			range = RansDecGet(&X, MantSec[e]->ProbBits);
-			m = MantSec[e - ModelSwitchThreshold]->RangeToSym(range);
-			RansDecAdvance(&X, &ptr, MantSec[e - ModelSwitchThreshold]->SymToLow(m), MantSec[e - ModelSwitchThreshold]->SymToFreq(m), MantSec[e - ModelSwitchThreshold]->ProbBits);
-			MantSec[e - ModelSwitchThreshold]->Update(m);
-		}	
-		R[0] = R[1];
-		R[1] = R[2];
-		R[2] = R[3];
-		R[3] = X;
+			unsigned short e, m;
+			RansState X = R[0];
+			int range = RansDecGet(&X, ExpModel->ProbBits);
+			e = ExpModel->RangeToSym(range);
+			RansDecAdvance(&X, &ptr, ExpModel->SymToLow(e), ExpModel->SymToFreq(e), ExpModel->ProbBits);
+			ExpModel->Update(e);
+			R[0] = R[1];
+			R[1] = R[2];
+			R[2] = R[3];
+			R[3] = X;
+			
+			X = R[0];
+			if(e < ModelSwitchThreshold) // Use adaptive model (best compression)
+			{
+				range = RansDecGet(&X, MantPrime[e]->ProbBits);
+				m = MantPrime[e]->RangeToSym(range);
+				RansDecAdvance(&X, &ptr, MantPrime[e]->SymToLow(m), MantPrime[e]->SymToFreq(m), MantPrime[e]->ProbBits);
+				MantPrime[e]->Update(m);
+			}
+			else // Use quasi static model (much faster on complex distributions)
+			{
+				range = RansDecGet(&X, MantSec[e]->ProbBits);
+				m = MantSec[e - ModelSwitchThreshold]->RangeToSym(range);
+				RansDecAdvance(&X, &ptr, MantSec[e - ModelSwitchThreshold]->SymToLow(m), MantSec[e - ModelSwitchThreshold]->SymToFreq(m), MantSec[e - ModelSwitchThreshold]->ProbBits);
+				MantSec[e - ModelSwitchThreshold]->Update(m);
+			}	
+			R[0] = R[1];
+			R[1] = R[2];
+			R[2] = R[3];
+			R[3] = X;
+			
+			rle0.Put(Exponent[e] + Mantissa[Exponent[e] + m]); // original symbol
+		}
 		
-		rlebuf[sptr] = Exponent[e] + Mantissa[Exponent[e] + m]; // original symbol
+		if(R[0] != RANS_BYTE_L || R[1] != RANS_BYTE_L || R[2] != RANS_BYTE_L || R[3] != RANS_BYTE_L)
+			Valid = false;
 	}
 	
-	if(R[0] != RANS_BYTE_L || R[1] != RANS_BYTE_L || R[2] != RANS_BYTE_L || R[3] != RANS_BYTE_L)
-		Error("Invalid rANS state!");
-	
 	for(int c = 0; c < ModelSwitchThreshold; c++)
 		delete MantPrime[c];
 	for(int c = 0; c < (MaxModels - ModelSwitchThreshold); c++)
 		delete MantSec[c];
 	delete ExpModel;
 	
-	RLE *rle0 = new RLE(); if(rle0 == NULL) 
-		Error("Couldn't allocate rle0!");
-	rle0->decode(rlebuf, &Output.block[out_p], &rlen, olen);
-	delete rle0;
-	free(rlebuf);
+	if(!rle0.End() || !Valid)
+		return false;
 	
 	Postcoder *rank = new Postcoder(); if(rank == NULL) 
 		Error("Couldn't allocate postcoder!");
-	rank->Decode(&Output.block[out_p], freqs, olen);
+	Valid = rank->Decode(work, freqs, olen, &Output.block[out_p]);
 	delete rank;
-	free(freqs);
+	return Valid;
 }
 
-void Ans::Encode(Buffer Input, Buffer Output, Options Opt)
+/**
+* Model one rle0 symbol, the exponent and mantissa ranges are packed as low | (freq - 1) << 16 since every model has 16 bit probabilities
+*/
+inline uint32_t *Ans::ModelSymbol(unsigned short sym, ChunkModels *Models, uint32_t *stack)
 {
-	AdaptiveModel *ExpModel = new AdaptiveModel(MaxModels);
-	AdaptiveModel *MantPrime[ModelSwitchThreshold];
-	QuasiModel *MantSec[MaxModels - ModelSwitchThreshold];
+	int e = Log[sym]; // 0 to 7
+	int m = Mantissa[sym]; // 8 models selected by exponent context
 	
+	#ifndef NDEBUG
+	if(Models->Exp->SymToFreq(e) <= 0)
+		Error("Exponent model failure (CDF)!");
+	#endif
+	stack[0] = Models->Exp->SymToLow(e) | ((Models->Exp->SymToFreq(e) - 1) << 16);
+	Models->Exp->Update(e);
+	
+	if(e < ModelSwitchThreshold) // Use adaptive model (best compression)
+	{
+		AdaptiveModel *Mant = Models->MantPrime[e];
+		stack[1] = Mant->SymToLow(m) | ((Mant->SymToFreq(m) - 1) << 16);
+		Mant->Update(m);
+	}
+	else // Use quasi static model (much faster on complex distributions)
+	{
+		QuasiModel *Mant = Models->MantSec[e - ModelSwitchThreshold];
+		stack[1] = Mant->SymToLow(m) | ((Mant->SymToFreq(m) - 1) << 16);
+		Mant->Update(m);
+	}
+	return stack + 2;
+}
+
+/**
+* Code one chunk (rank, rle0, models, rANS) with its own models and scratch, the rANS stream ends at tmp + StackSize * 2.
+* Rank coding writes the ranks to 'work', from there rle0 and the models run as one pass straight into the range stack,
+* so the 16-bit rle0 symbols are never buffered. If the stream doesn't pay off the chunk points at its input and is stored raw.
+*/
+void Ans::EncodeChunk(unsigned char *in, int mode, uint32_t *stack, unsigned char *tmp, unsigned char *work, EncodedChunk *Chunk)
+{
+	ChunkModels Models;
+	Models.Exp = new AdaptiveModel(MaxModels);
 	for(int c = 0; c < ModelSwitchThreshold; c++)
-		MantPrime[c] = new AdaptiveModel(Exponent[c + 1] - Exponent[c]);
+		Models.MantPrime[c] = new AdaptiveModel(Exponent[c + 1] - Exponent[c]);
+	for(int c = 0; c < (MaxModels - ModelSwitchThreshold); c++)
+		Models.MantSec[c] = new QuasiModel(Exponent[c + ModelSwitchThreshold + 1] - Exponent[c + ModelSwitchThreshold]);
 	
+	Models.Exp->Reset();
+	for(int c = 0; c < ModelSwitchThreshold; c++)
+		Models.MantPrime[c]->Reset();
 	for(int c = 0; c < (MaxModels - ModelSwitchThreshold); c++)
-		MantSec[c] = new QuasiModel(Exponent[c + ModelSwitchThreshold + 1] - Exponent[c + ModelSwitchThreshold]);
+		Models.MantSec[c]->Reset();
 	
 	Postcoder *rank = new Postcoder;
-	RLE *rle0 = new RLE;
-	Range_t *stack = (Range_t*)malloc(StackSize * 2 * sizeof(Range_t)); if(stack == NULL) Error("Failed to alloc ans encoder stack!");
-	int *freqs = (int*)malloc(256 * sizeof(int)); if(freqs == NULL) Error("Failed to alloc rank freq array!");
-	unsigned short *rlebuf = (unsigned short*)malloc(StackSize * sizeof(unsigned short)); if(rlebuf == NULL) Error("Couldn't allocate rle buffer!");
-	unsigned char *tmp = (unsigned char*)malloc(StackSize * 2 * sizeof(unsigned char)); if(tmp == NULL) Error("Couldn't allocate temporary buffer!");
-
-	Index in_p = 0;
-	Index out_p = 0;
-	for(; in_p < *Input.size; )
+	int len = Chunk->len;
+	rank->Encode(in, Chunk->freqs, len, work);
+	delete rank;
+	
+	// Runs of zero ranks become the bits of run + 1 below its top bit as symbols 0 and 1, other ranks are coded as rank + 1
+	// Static chunks need the counts before coding, their symbols are collected in the stack instead
+	uint32_t *sp = stack;
+	uint16_t *syms = (uint16_t*)stack;
+	int rlen = 0;
+	for(int i = 0; i < len;)
 	{
-		ExpModel->Reset();
-		for(int c = 0; c < ModelSwitchThreshold; c++)
-			MantPrime[c]->Reset();
-		for(int c = 0; c < (MaxModels - ModelSwitchThreshold); c++)
-			MantSec[c]->Reset();
-		
-		int len = ((in_p + StackSize) < *Input.size) ? StackSize : (*Input.size - in_p);
-		rank->Encode(&Input.block[in_p], freqs, len);
-		int rlen = len;
-		rle0->encode(&Input.block[in_p], rlebuf, &rlen);
-		
-		// Structured symbol buffer
-		int sptr = 0;
-		unsigned short sym = 0;
-		int e; // exponent
-		int m; // mantissa
-		for(int i = 0; i < rlen; i++)
+		if(work[i] == 0)
 		{
-			sym = rlebuf[i];
-			e = Log[sym]; // 0 to 7
-			m = Mantissa[sym]; // 8 models selected by exponent context
-			
-			stack[sptr].low = ExpModel->SymToLow(e);
-			stack[sptr].freq = ExpModel->SymToFreq(e);
-			ExpModel->Update(e);
+			int run = 1;
+			while((i + run) < len && work[i + run] == 0)
+				run++;
+			i += run;
 			
-			#ifndef NDEBUG
-			if(stack[sptr].freq <= 0)
-				Error("Exponent model failure (CDF)!");
-			#endif
-			if(e < ModelSwitchThreshold) // Use adaptive model (best compression)
+			unsigned int L = run + 1;
+			int msb = 0;
+			while((L >> (msb + 1)) != 0)
+				msb++;
+			while(msb--)
 			{
-				stack[sptr + 1].low = MantPrime[e]->SymToLow(m);
-				stack[sptr + 1].freq = MantPrime[e]->SymToFreq(m);
-				MantPrime[e]->Update(m);
-				#ifndef NDEBUG
-				if(stack[sptr + 1].freq <= 0)
-					Error("Mantissa model failure (CDF)!");
-				#endif
+				if(mode == ModeStatic)
+					syms[rlen] = (L >> msb) & 1;
+				else
+					sp = ModelSymbol((L >> msb) & 1, &Models, sp);
+				rlen++;
 			}
-			else // Use quasi static model (much faster on complex distributions)
-			{
-				stack[sptr + 1].low = MantSec[e - ModelSwitchThreshold]->SymToLow(m);
-				stack[sptr + 1].freq = MantSec[e - ModelSwitchThreshold]->SymToFreq(m);
-				MantSec[e - ModelSwitchThreshold]->Update(m);
-				#ifndef NDEBUG
-				if(stack[sptr + 1].freq <= 0)
-					Error("Mantissa model failure (Quasi)!");
-				#endif
-			}
-			sptr += 2;
 		}
-		
+		else
+		{
+			if(mode == ModeStatic)
+				syms[rlen] = work[i] + 1;
+			else
+				sp = ModelSymbol(work[i] + 1, &Models, sp);
+			i++;
+			rlen++;
+		}
+	}
+	int sptr = sp - stack;
+	
+	uint8_t* ptr = tmp + (StackSize * 2); // *end* of temporary buffer
+	uint8_t* end = ptr;
+	if(mode == ModeStatic) // tANS writes forward from the start of the buffer
+	{
+		int Freq[TANS_SYMBOLS] = {0};
+		for(int i = 0; i < rlen; i++)
+			Freq[syms[i]]++;
+		TansNormalize(Freq, rlen, Chunk->norms);
+		ptr = tmp;
+		end = tmp + TansEncode(syms, rlen, Chunk->norms, tmp);
+	}
+	else if(mode == ModeLanes)
+	{
+		uint32_t R[RANS_LANES];
+		for(int l = 0; l < RANS_LANES; l++)
+			R[l] = RANS_WORD_L;
+		for(Index i = sptr; i > 0; i--) // working in reverse, value i - 1 belongs to lane (i - 1) % RANS_LANES
+			RansWordEncPut(&R[(i - 1) % RANS_LANES], &ptr, stack[i-1] & 0xffff, (stack[i-1] >> 16) + 1);
+		for(int l = RANS_LANES - 1; l >= 0; l--)
+			RansWordEncFlush(&R[l], &ptr);
+	}
+	else
+	{
 		RansState R[4];
 		RansEncInit(&R[0]);
 		RansEncInit(&R[1]);
 		RansEncInit(&R[2]);
 		RansEncInit(&R[3]);
-		uint8_t *rans_begin;
-		uint8_t* ptr = tmp + (StackSize * 2); // *end* of temporary buffer
 		for (size_t i=sptr; i > 0; i--) // working in reverse!
 		{
 			RansState X = R[3];
-			RansEncPut(&X, &ptr, stack[i-1].low, stack[i-1].freq, ExpModel->ProbBits); // All models use the same number of ProbBits
+			RansEncPut(&X, &ptr, stack[i-1] & 0xffff, (stack[i-1] >> 16) + 1, Models.Exp->ProbBits); // All models use the same number of ProbBits
 			R[3] = R[2];
 			R[2] = R[1];
 			R[1] = R[0];
@@ -206,97 +344,181 @@ void Ans::Encode(Buffer Input, Buffer Output, Options Opt)
 		RansEncFlush(&R[2], &ptr);
 		RansEncFlush(&R[1], &ptr);
 		RansEncFlush(&R[0], &ptr);
+	}
+	
+	Chunk->mode = mode;
+	Chunk->rans_begin = ptr;
+	Chunk->csize = end - ptr;
+	Chunk->rlen = rlen;
+	if(Chunk->csize > len - (len >> RawShift))
+	{
+		Chunk->mode = ModeRaw;
+		Chunk->rans_begin = in;
+		Chunk->csize = len;
+		Chunk->rlen = 0;
+		memset(Chunk->freqs, 0, 256 * sizeof(int));
+	}
+	
+	for(int c = 0; c < ModelSwitchThreshold; c++)
+		delete Models.MantPrime[c];
+	for(int c = 0; c < (MaxModels - ModelSwitchThreshold); c++)
+		delete Models.MantSec[c];
+	delete Models.Exp;
+}
 
-		rans_begin = ptr;
-		int csize = &tmp[StackSize*2] - rans_begin;
-		out_p += WriteHeader(&Output.block[out_p], &len, &csize, &rlen, &freqs[0]);
+/**
+* Chunks are coded in batches, one per thread into private scratch, and appended to the output in chunk order.
+* The block may use the threads the pipeline handed to its suffix sort, but never more than it has chunks, every thread takes 11 MB of scratch.
+* Returns JAM_OK, or JAM_ERROR_MEMORY if the scratch can't be allocated.
+*/
+int Ans::Encode(Buffer Input, Buffer Output, Options Opt)
+{
+	const int ChunkCount = (int)(((int64_t)*Input.size + StackSize - 1) / StackSize);
+	const int Threads = __max(1, __min((int)Opt.SortThreads, ChunkCount));
+	const int mode = (Opt.EntropyMode == 1) ? ModeLanes : (Opt.EntropyMode == 2) ? ModeStatic : ModeBytewise;
+	size_t mark = Workspace->Mark();
+	uint32_t *stack = Workspace->Alloc<uint32_t>((size_t)StackSize * 2 * Threads);
+	unsigned char *tmp = Workspace->Alloc<unsigned char>((size_t)StackSize * 2 * Threads);
+	unsigned char *work = Workspace->Alloc<unsigned char>((size_t)StackSize * Threads);
+	EncodedChunk *Chunks = Workspace->Alloc<EncodedChunk>(Threads);
+	if(stack == NULL || tmp == NULL || work == NULL || Chunks == NULL)
+	{
+		Workspace->Release(mark);
+		return JAM_ERROR_MEMORY;
+	}
 
-		// Merge the buffer to the output stream
-		for(int k = 0; k < csize; k++) 
-			Output.block[out_p+k] = rans_begin[k];
+	Index in_p = 0;
+	Index out_p = 0;
+	for(; in_p < *Input.size; )
+	{
+		int s = 0;
+		while((in_p < *Input.size) && (s < Threads))
+		{
+			Chunks[s].start = in_p;
+			Chunks[s].len = ((in_p + StackSize) < *Input.size) ? StackSize : (*Input.size - in_p);
+			in_p += Chunks[s].len;
+			s++;
+		}
 		
-		out_p += csize;
-		in_p += len;
+		#pragma omp parallel for num_threads(s)
+		for(int k = 0; k < s; k++)
+			EncodeChunk(&Input.block[Chunks[k].start], mode, &stack[(size_t)StackSize * 2 * k], 
+				&tmp[(size_t)StackSize * 2 * k], &work[(size_t)StackSize * k], &Chunks[k]);
+		
+		// Merge the buffers to the output stream
+		for(int k = 0; k < s; k++)
+		{
+			out_p += WriteHeader(&Output.block[out_p], &Chunks[k].len, &Chunks[k].csize, &Chunks[k].rlen, &Chunks[k].freqs[0], Chunks[k].mode, &Chunks[k].norms[0]);
+			memcpy(&Output.block[out_p], Chunks[k].rans_begin, Chunks[k].csize);
+			out_p += Chunks[k].csize;
+		}
 	}
 	*Output.size = out_p;
 
-	free(stack);
-	free(tmp);
-	free(rlebuf);
-	free(freqs);
-	for(int c = 0; c < ModelSwitchThreshold; c++)
-		delete MantPrime[c];
-	for(int c = 0; c < (MaxModels - ModelSwitchThreshold); c++)
-		delete MantSec[c];
-	delete ExpModel;
-	delete rank;
-	delete rle0;
+	Workspace->Release(mark);
+	return JAM_OK;
 }
 
-void Ans::Decode(Buffer Input, Buffer Output, Options Opt)
+/**
+* Returns JAM_OK, JAM_ERROR_CORRUPT if a chunk header or stream doesn't decode or the chunks don't fit the block, or JAM_ERROR_MEMORY
+*/
+int Ans::Decode(Buffer Input, Buffer Output, Options Opt)
 {
 	const int Threads = Opt.Threads;
 	ParallelAns* pANS = new ParallelAns[Threads];
-	int *freqs = new int[256]; 
-	if(freqs == NULL) 
-		Error("Failed to alloc rank freq array!");
+	int freqs[256];
+	int norms[TANS_SYMBOLS];
+	
+	size_t mark = Workspace->Mark();
+	unsigned char *work = Workspace->Alloc<unsigned char>((size_t)StackSize * Threads);
 	
 	int in_p = 0;
 	int out_p = 0;
+	int Status = (work != NULL) ? JAM_OK : JAM_ERROR_MEMORY;
 	
-	for(; in_p < *Input.size; )
+	for(; in_p < *Input.size && Status == JAM_OK; )
 	{
 		int olen = 0;
 		int clen = 0;
 		int rlen = 0;
+		int mode = 0;
 		int s = 0;
 		
 		while ((in_p < *Input.size) && (s < Threads))
 		{
-			in_p += ReadHeader(&Input.block[in_p], &olen, &clen, &rlen, &freqs[0], StackSize);
-			pANS[s].Load(Input, Output, in_p, out_p, clen, olen, rlen, &freqs[0]);
+			int len = ReadHeader(&Input.block[in_p], &olen, &clen, &rlen, &freqs[0], &mode, &norms[0], StackSize);
+			if(len < 0 || clen > *Input.size - in_p - len || olen > Output.capacity - out_p) // The chunks of a block never add up past its buffer
+			{
+				Status = JAM_ERROR_CORRUPT;
+				break;
+			}
+			in_p += len;
+			pANS[s].Load(Input, Output, in_p, out_p, clen, olen, rlen, &freqs[0], &norms[0], &work[(size_t)StackSize * s], mode);
 			in_p += clen;
 			out_p += olen;
 			s++;
 		}
-		#pragma omp parallel for num_threads(s)
+		if(s == 0)
+			break;
+		
+		int Corrupt = 0;
+		#pragma omp parallel for num_threads(s) reduction(+:Corrupt)
 		for(int k = 0; k < s; k++)
-			pANS[k].Threaded_Decode();
+			Corrupt += !pANS[k].Threaded_Decode();
+		if(Corrupt > 0)
+			Status = JAM_ERROR_CORRUPT;
 	}
 
 	*Output.size = out_p;
+	Workspace->Release(mark);
 	delete[] pANS;
-	delete[] freqs;
+	return Status;
 }
 
-int Ans::WriteHeader(unsigned char* outbuf, int* olen, int* clen, int* rlen, int* A)
+/**
+* The chunk header is the rank frequencies followed by the chunk sizes, the coder mode is kept above the bits of the output length
+* so chunks coded with the original four state layout (mode 0) are unchanged. Raw chunks keep the layout with zero frequencies,
+* static chunks append their normalized tANS counts.
+*/
+int Ans::WriteHeader(unsigned char* outbuf, int* olen, int* clen, int* rlen, int* A, int mode, int* Norm)
 {
-	Utils *leb = new Utils;
 	int pos = 0;
 		
 	for(int i = 0; i < 256; i++)
-		pos += leb->EncodeLeb128(A[i], &outbuf[pos]);
-	pos += leb->EncodeLeb128(*olen, &outbuf[pos]);
-	pos += leb->EncodeLeb128(*clen, &outbuf[pos]);
-	pos += leb->EncodeLeb128(*rlen, &outbuf[pos]);
-	delete leb;
+		pos += Leb->EncodeLeb128(A[i], &outbuf[pos]);
+	pos += Leb->EncodeLeb128(*olen | (mode << ModeShift), &outbuf[pos]);
+	pos += Leb->EncodeLeb128(*clen, &outbuf[pos]);
+	pos += Leb->EncodeLeb128(*rlen, &outbuf[pos]);
+	if(mode == ModeStatic)
+		for(int i = 0; i < TANS_SYMBOLS; i++)
+			pos += Leb->EncodeLeb128(Norm[i], &outbuf[pos]);
 	
 	return pos;
 }
 
-int Ans::ReadHeader(unsigned char* inbuf, int* olen, int* clen, int* rlen, int* A, int StackSize)
+/**
+* Returns the header length, or JAM_ERROR_CORRUPT if the sizes or the mode are out of range
+*/
+int Ans::ReadHeader(unsigned char* inbuf, int* olen, int* clen, int* rlen, int* A, int* mode, int* Norm, int StackSize)
 {
-	Utils *leb = new Utils;
 	int pos = 0;
 	
 	for(int i = 0; i < 256; i++)
-		pos += leb->DecodeLeb128(&A[i], &inbuf[pos]);
-	pos += leb->DecodeLeb128(olen, &inbuf[pos]);
-	pos += leb->DecodeLeb128(clen, &inbuf[pos]);
-	pos += leb->DecodeLeb128(rlen, &inbuf[pos]);
-	if(!(*olen >= 0 && *olen <= StackSize) || !(*rlen >= 0 && *rlen <= StackSize)) 
-		Error("Misaligned or corrupt header!"); 
-	delete leb;
+		pos += Leb->DecodeLeb128(&A[i], &inbuf[pos]);
+	pos += Leb->DecodeLeb128(olen, &inbuf[pos]);
+	pos += Leb->DecodeLeb128(clen, &inbuf[pos]);
+	pos += Leb->DecodeLeb128(rlen, &inbuf[pos]);
+	*mode = *olen >> ModeShift;
+	*olen &= (1 << ModeShift) - 1;
+	if(*mode < 0 || *mode >= ModeCount) // Unsupported entropy coder mode
+		return JAM_ERROR_CORRUPT;
+	if(!(*olen >= 0 && *olen <= StackSize) || !(*rlen >= 0 && *rlen <= StackSize) || *clen < 0) // Misaligned or corrupt header
+		return JAM_ERROR_CORRUPT; 
+	if(*mode == ModeRaw && *clen != *olen)
+		return JAM_ERROR_CORRUPT; 
+	if(*mode == ModeStatic)
+		for(int i = 0; i < TANS_SYMBOLS; i++)
+			pos += Leb->DecodeLeb128(&Norm[i], &inbuf[pos]);
 	
 	return pos;
 }
\ No newline at end of file
@@ -6,40 +6,70 @@
 
 #include "format.hpp"
 #include "rans_byte.hpp"
+#include "rans_lanes.hpp"
+#include "tans.hpp"
 #include "model.hpp"
 #include "rank.hpp"
 #include "rle.hpp"
 #include "utils.hpp"
 #include "tables.hpp"
+#include "arena.hpp"
 
 class Ans
 {
 	private:
-	int WriteHeader(unsigned char* outbuf, int* olen, int* clen, int* rlen, int* A);
-	int ReadHeader(unsigned char* inbuf, int* olen, int* clen, int* rlen, int* A, int StackSize);
+	int WriteHeader(unsigned char* outbuf, int* olen, int* clen, int* rlen, int* A, int mode, int* Norm);
+	int ReadHeader(unsigned char* inbuf, int* olen, int* clen, int* rlen, int* A, int* mode, int* Norm, int StackSize);
 	
 	static const int StackSize = 1 << 20;
-	struct Range_t
-	{
-		int low;
-		int freq;
-	};
 	
 	static const int MaxModels = 8;
 	static const int ModelSwitchThreshold = 2; // Exp[0 to 1] uses adaptive model, Exp[2 to 7] uses quasi static model
 	
+	enum { ModeBytewise, ModeLanes, ModeRaw, ModeStatic, ModeCount }; // Layout of the stream of a chunk, raw chunks are stored as is, static chunks use tANS
+	static const int RawShift = 6; // Chunks saving less than 1/64 of their size are stored raw
+	static const int ModeShift = 21; // The mode is stored above the output length of the chunk header
+	
+	Arena *Workspace;			// Encoder stack and decoder chunk buffers are borrowed from the instance arena
+	Utils *Leb;
+	
+	struct EncodedChunk			// A chunk coded into private scratch, waiting to be appended in order
+	{
+		Index start;
+		int mode;
+		int len;
+		int csize;
+		int rlen;
+		int freqs[256];
+		int norms[TANS_SYMBOLS];		// tANS table of a static chunk
+		uint8_t *rans_begin;
+	};
+	void EncodeChunk(unsigned char *in, int mode, uint32_t *stack, unsigned char *tmp, unsigned char *work, EncodedChunk *Chunk);
+	
+	struct ChunkModels			// Exponent model and the mantissa models it selects
+	{
+		AdaptiveModel *Exp;
+		AdaptiveModel *MantPrime[ModelSwitchThreshold];
+		QuasiModel *MantSec[MaxModels - ModelSwitchThreshold];
+	};
+	static inline uint32_t *ModelSymbol(unsigned short sym, ChunkModels *Models, uint32_t *stack);
+	
 	public:
-	void Encode(Buffer Input, Buffer Output, Options Opt);
-	void Decode(Buffer Input, Buffer Output, Options Opt);
+	Ans(Arena *Scratch);
+	~Ans();
+	int Encode(Buffer Input, Buffer Output, Options Opt);	// JAM_OK or JAM_ERROR_MEMORY
+	int Decode(Buffer Input, Buffer Output, Options Opt);	// JAM_OK, JAM_ERROR_CORRUPT, or JAM_ERROR_MEMORY
 	
 	class ParallelAns
 	{
 		private:
-		Buffer Input; Buffer Output; Index in_p; Index out_p; Index clen; Index olen; Index rlen; Index *freqs;
+		Buffer Input; Buffer Output; Index in_p; Index out_p; Index clen; Index olen; Index rlen; Index freqs[256]; int norms[TANS_SYMBOLS];
+		unsigned char *work; // Per-thread rank array, StackSize bytes
+		int mode;
 		
 		public:
-		void Load (Buffer _Input, Buffer _Output, Index _in_p, Index _out_p, Index _clen, Index _olen, Index _rlen, Index *_freqs);
-		void Threaded_Decode();
+		void Load (Buffer _Input, Buffer _Output, Index _in_p, Index _out_p, Index _clen, Index _olen, Index _rlen, Index *_freqs, int *_norms, unsigned char *_work, int _mode);
+		bool Threaded_Decode();	// False if the chunk is corrupt
 	};
 };
 
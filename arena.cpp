@@ -0,0 +1,167 @@
+/*********************************************
+* Workspace arena
+*
+* The arena is a list of chunks which are filled in order, a mark is the position of the bump pointer
+* as if all chunks were laid out back to back. When a request doesn't fit in the current chunk we move on
+* to the next one, allocating it if needed. Once the arena is completely released and it took more than
+* one chunk to serve the last block, the chunks are merged into one so the next block is served linearly.
+*
+* With huge pages the chunks are rounded up to and aligned on HUGE_PAGE_SIZE and the kernel is asked to back them with
+* transparent huge pages, suffix arrays and inverse maps are accessed randomly so 4 KB pages spend most of the time in TLB misses.
+* If the aligned allocation fails the chunk falls back to plain malloc.
+**********************************************/
+#include "arena.hpp"
+#ifndef _WIN32
+	#include <sys/mman.h>
+#endif
+
+Arena::Arena(bool Huge)
+{
+	Chunks = NULL;
+	ChunkCount = 0;
+	Current = 0;
+	HugePages = Huge;
+}
+
+Arena::~Arena()
+{
+	for(int c = 0; c < ChunkCount; c++)
+		FreeChunk(&Chunks[c]);
+	free(Chunks);
+}
+
+/**
+* Huge page aligned memory, NULL if the platform refuses
+*/
+static void *AllocHuge(size_t size)
+{
+	void *p = NULL;
+#ifdef _WIN32
+	p = _aligned_malloc(size, HUGE_PAGE_SIZE);
+#else
+	if(posix_memalign(&p, HUGE_PAGE_SIZE, size) != 0)
+		return NULL;
+	#ifdef MADV_HUGEPAGE
+	madvise(p, size, MADV_HUGEPAGE); // Only a hint, without THP support the pages stay small
+	#endif
+#endif
+	return p;
+}
+
+void Arena::FreeChunk(Chunk *c)
+{
+#ifdef _WIN32
+	if(c->Huge)
+	{
+		_aligned_free(c->Base);
+		return;
+	}
+#endif
+	free(c->Base);
+}
+
+bool Arena::AddChunk(size_t size)
+{
+	Chunk *Grown = (Chunk*)realloc(Chunks, (ChunkCount + 1) * sizeof(Chunk));
+	if(Grown == NULL)
+		return false;
+	Chunks = Grown;
+
+	Chunk *c = &Chunks[ChunkCount];
+	c->Base = NULL;
+	c->Huge = false;
+	if(HugePages)
+	{
+		size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t)HUGE_PAGE_SIZE - 1);
+		c->Base = (unsigned char*)AllocHuge(size);
+		c->Huge = (c->Base != NULL);
+	}
+	if(c->Base == NULL)
+		c->Base = (unsigned char*)malloc(size);
+	if(c->Base == NULL)
+		return false;
+	c->Size = size;
+	c->Used = 0;
+	ChunkCount++;
+	return true;
+}
+
+size_t Arena::ChunkStart(int c)
+{
+	size_t start = 0;
+	for(int i = 0; i < c; i++)
+		start += Chunks[i].Size;
+	return start;
+}
+
+bool Arena::Reserve(size_t size)
+{
+	if(Mark() != 0)
+		Error("Workspace arena can only be reserved while it is empty!");
+
+	size_t total = ChunkStart(ChunkCount);
+	if(ChunkCount == 1 && total >= size)
+		return true;
+
+	for(int c = 0; c < ChunkCount; c++)
+		FreeChunk(&Chunks[c]);
+	ChunkCount = 0;
+	Current = 0;
+	return AddChunk((total > size) ? total : size);
+}
+
+void *Arena::Alloc(size_t size)
+{
+	size = (size + Alignment - 1) & ~(Alignment - 1);
+
+	while(Current < ChunkCount)
+	{
+		Chunk *c = &Chunks[Current];
+		size_t pos = (size_t)(-(intptr_t)c->Base) & (Alignment - 1); // Align the start of the chunk
+		if(c->Used > pos)
+			pos = c->Used;
+		if(pos + size <= c->Size)
+		{
+			c->Used = pos + size;
+			return &c->Base[pos];
+		}
+		if(Current + 1 == ChunkCount)
+			break;
+		Current++;
+	}
+
+	size_t grow = (ChunkCount > 0) ? Chunks[ChunkCount - 1].Size : MinChunk;
+	if(!AddChunk(((size + Alignment) > grow) ? (size + Alignment) : grow))
+		return NULL; // The stage hands JAM_ERROR_MEMORY back up
+	Current = ChunkCount - 1;
+	return Alloc(size);
+}
+
+size_t Arena::Mark()
+{
+	if(ChunkCount == 0)
+		return 0;
+	return ChunkStart(Current) + Chunks[Current].Used;
+}
+
+void Arena::Release(size_t mark)
+{
+	int c = 0;
+	size_t start = 0;
+	for(; c < ChunkCount; c++)
+	{
+		if(mark <= start + Chunks[c].Size)
+			break;
+		start += Chunks[c].Size;
+	}
+	if(c == ChunkCount)
+		return;
+
+	Chunks[c].Used = mark - start;
+	for(int i = c + 1; i < ChunkCount; i++)
+		Chunks[i].Used = 0;
+	Current = c;
+
+	if(mark == 0 && ChunkCount > 1) // The last block didn't fit in one chunk, merge them
+		Reserve(ChunkStart(ChunkCount));
+}
@@ -0,0 +1,49 @@
+/*********************************************
+* Workspace arena
+* Every codec instance owns one arena which all of its stages borrow scratch memory from.
+* Allocation is a pointer bump, a stage marks the arena on entry and releases back to the mark on exit,
+* so after the first block the same pages are handed out again without malloc, free, or zeroing.
+*
+* The arena is not thread safe, stages carve out per-thread scratch before entering a parallel region.
+**********************************************/
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "format.hpp"
+
+class Arena
+{
+	public:
+	Arena(bool Huge);			// Huge backs the chunks with 2 MB aligned, huge page advised memory
+	~Arena();
+
+	bool Reserve(size_t size);		// Make sure 'size' bytes can be handed out without growing, false if that memory isn't available
+	void *Alloc(size_t size);		// Bump allocate, the memory is not cleared, NULL if the arena can't grow
+	size_t Mark();				// Current position of the arena
+	void Release(size_t mark);		// Return everything allocated after 'mark'
+
+	template <typename T> T *Alloc(size_t count) { return (T*)Alloc(count * sizeof(T)); }
+
+	private:
+	static const size_t Alignment = 64;
+	static const size_t MinChunk = 4 << 20;
+
+	struct Chunk
+	{
+		unsigned char *Base;
+		size_t Size;
+		size_t Used;
+		bool Huge;			// Allocated aligned, needs the matching free on Windows
+	};
+
+	Chunk *Chunks;
+	int ChunkCount;
+	int Current;				// Chunk we are currently bumping in
+	bool HugePages;
+
+	bool AddChunk(size_t size);		// False if the memory isn't available, the arena is left as it was
+	void FreeChunk(Chunk *c);
+	size_t ChunkStart(int c);		// Position of a chunk, chunks are laid out back to back
+};
+
+#endif // ARENA_H
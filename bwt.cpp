@@ -3,6 +3,7 @@
 * Parallel and Out-of-Order execution decoding on a single block.
 **********************************************/
 #include "bwt.hpp"
+#include <immintrin.h>
 
 #ifdef __CUDACC__
 __global__ void BlockSort::CUDAInverse(int Threads, int Units, unsigned char *Bwt, unsigned char *T, int Step, Index *p, Index Idx, Index* MAP, int *Offset)
@@ -19,173 +20,297 @@ __global__ void BlockSort::CUDAInverse(int Threads, int Units, unsigned char *Bw
 }
 #endif
 
-void BlockSort::Bwt::ForwardBwt(Buffer Input, Buffer Output)
+BlockSort::Bwt::Bwt(Arena *Scratch)
+{
+	Workspace = Scratch;
+	Simd = GetSimdLevel();
+}
+
+/**
+* Amount of sampled indices for a block, a power of two so limited context sort segments divide it evenly.
+* One index every 8 KB costs 0.05% of the block and gives the decoder plenty of independent chains per thread.
+*/
+static Index BwtUnits(Index Len)
+{
+	Index Units = BWT_MIN_UNITS;
+	while(Units < BWT_MAX_UNITS && (Units << 1) <= (Len >> BWT_UNIT_SHIFT))
+		Units <<= 1;
+	return Units;
+}
+
+/**
+* Returns JAM_OK, or JAM_ERROR_MEMORY if the suffix sort can't get its workspace
+*/
+int BlockSort::Bwt::ForwardBwt(Buffer Input, Buffer Output, Options Opt)
 {
 	unsigned char *T = Input.block;
 	unsigned char* Bwt = Output.block;
 	int Len = *Input.size;
-	*Output.size = *Input.size + (BWT_UNITS * sizeof(Index));
+	Index Units = BwtUnits(Len);
+	*Output.size = *Input.size + BWT_TAIL(Units);
 	
-	int remainder = Len % BWT_UNITS;
+	int remainder = Len % Units;
 	int nlen = Len - remainder;
 
 	for(int i = 0; i < remainder; i++) 
 		Bwt[nlen + i] = T[nlen + i]; 
 	
-	if(nlen > 0)
+	size_t mark = Workspace->Mark();
+	Index *Indicies = Workspace->Alloc<Index>(Units);
+	if(Indicies == NULL)
 	{
-		Index Indicies[BWT_UNITS] = {0};
-		Index *SA = (Index*)calloc(nlen, sizeof(Index)); 
-		if (SA == NULL) 
-			Error("Bwt :: Couldn't allocate suffix array!");
-		if(divsufsort(T, SA, nlen) != 0) 
-			Error("Bwt :: Failure computing the Suffix Array!");
+		Workspace->Release(mark);
+		return JAM_ERROR_MEMORY;
+	}
+	memset(Indicies, 0, Units * sizeof(Index));
+	int Order = (Opt.SortOrder >= ST_MIN_ORDER && Opt.SortOrder <= ST_MAX_ORDER) ? Opt.SortOrder : 0;
+	if(nlen > 0 && Order != 0)
+	{
+		if(!ForwardSt(T, Bwt, nlen, Order, Units, Indicies, Opt.SortThreads))
+		{
+			Workspace->Release(mark);
+			return JAM_ERROR_MEMORY;
+		}
+	}
+	else if(nlen > 0)
+	{
+		// The sampled suffix positions are recorded while the transform is induced, 
+		// the workspace holds symbols instead of suffixes by the end so there's no second pass over a suffix array.
+		Index *SA = Workspace->Alloc<Index>(nlen); 
+		if(SA == NULL)
+		{
+			Workspace->Release(mark);
+			return JAM_ERROR_MEMORY;
+		}
+		int step = nlen / Units;
+		if(divbwt_sampled(T, Bwt, SA, nlen, step, Indicies, Opt.SortThreads) < 0) 
+			Error("Bwt :: Failure computing the Burrows Wheeler transform!");
 
-		int step = nlen / BWT_UNITS;
-		
-		for(Index i = 0; i < nlen; i++) 
-			if((SA[i] % step) == 0) 
-				Indicies[SA[i] / step] = i;
-		
-		Bwt[0] = T[nlen - 1];
-		Index idx = Indicies[0];
-			
-		for(Index i = 0; i < idx; i++) 
-			Bwt[i + 1] = T[(SA[i] - 1) % nlen];
-		for(Index i = idx + 1; i < nlen; i++) 
-			Bwt[i] = T[(SA[i] - 1) % nlen];
-		for(Index i = 0; i < BWT_UNITS; i++) 
+		for(Index i = 0; i < Units; i++) 
 			Indicies[i] += 1;
-		
-		for(Index i = 0; i < BWT_UNITS; i++)
-			memcpy(&Bwt[Len + (i * sizeof(Index))], &Indicies[i], sizeof(Index));
+	}
+	
+	memcpy(&Bwt[Len], Indicies, Units * sizeof(Index));
+	memcpy(&Bwt[Len + (Units * sizeof(Index))], &Units, sizeof(Index));
+	Bwt[Len + (Units * sizeof(Index)) + sizeof(Index)] = Order;
+	Workspace->Release(mark);
+	return JAM_OK;
+}
 
-		free(SA);
+/**
+* Every thread counts the symbols of its own slice of the block, with the usual 8-way split of the counters to avoid store-to-load stalls on runs.
+* The counts are turned into the position where each slice starts scattering each symbol: 
+* a prefix sum over the symbols of the whole block, then over the slices within a symbol, so the parallel scatter lands exactly where the serial one did.
+* Slice n covers [nlen * n / Threads, nlen * (n + 1) / Threads), Offsets holds Threads * 256 entries.
+*/
+static void SliceOffsets(const unsigned char *Bwt, Index nlen, int Threads, Index *Offsets)
+{
+	#pragma omp parallel for num_threads(Threads)
+	for(int n = 0; n < Threads; n++)
+	{
+		Index start = (Index)((int64_t)nlen * n / Threads);
+		Index end = (Index)((int64_t)nlen * (n + 1) / Threads);
+		Index F[8][256] = {{0}};
+		Index j = end;
+		while((j - 8) > start)
+		{
+			++F[0][Bwt[j-1]];
+			++F[1][Bwt[j-2]];
+			++F[2][Bwt[j-3]];
+			++F[3][Bwt[j-4]];
+			++F[4][Bwt[j-5]];
+			++F[5][Bwt[j-6]];
+			++F[6][Bwt[j-7]];
+			++F[7][Bwt[j-8]];
+			j -= 8;
+		}
+		while(j > start)
+		{
+			++F[0][Bwt[j-1]];
+			j--;
+		}
+		for(int k = 0; k < 256; k++)
+			Offsets[n * 256 + k] = F[0][k] + F[1][k] + F[2][k] + F[3][k] + F[4][k] + F[5][k] + F[6][k] + F[7][k];
+	}
+	
+	Index sum = 0;
+	for(int k = 0; k < 256; k++)
+	{
+		for(int n = 0; n < Threads; n++)
+		{
+			Index c = Offsets[n * 256 + k];
+			Offsets[n * 256 + k] = sum;
+			sum += c;
+		}
 	}
 }
 
 /**
-* Sharing an even workload over an uneven amount of threads is kinda tricky, you end up losing position information when you round.
-* Easiest solution is to have the maximum allowed threads be a least common multiple of common thread counts.
-* 120 is a nice multiple of 1, 2, 3, 4, 5, 6, and 8. Which is fine for CPU threading, and GPU threading.
+* Every instance holds its input, its output, and the packed map of the block in flight, 
+* when that doesn't fit for all instances at once the block is inverted with sampled rank tables instead.
 */
-void BlockSort::Bwt::InverseBwt(Buffer Input, Buffer Output, Options Opt)
+bool BlockSort::Bwt::LowMemory(Index Len, Options Opt)
+{
+	if(Opt.LowMemory == true)
+		return true;
+	uint64_t Instances = (Opt.Multiblock == true) ? Opt.Threads + PIPELINE_DEPTH : 1;
+	uint64_t Full = (uint64_t)Len * (2 + ((Len < (1 << 24)) ? 4 : 5)) + ARENA_SLACK;
+	return (double)(Full * Instances) > (double)GetAvailableMemory() * MAX_MEMORY_USAGE;
+}
+
+static size_t RankTableSize(Index Len)
+{
+	size_t Blocks = ((size_t)Len >> RANK_BLOCK_SHIFT) + 1;
+	size_t Supers = ((size_t)Len >> RANK_SUPER_SHIFT) + 2;
+	return Blocks * 256 * sizeof(uint16_t) + Supers * 256 * sizeof(Index);
+}
+
+/**
+* The block header doesn't tell a BWT from a limited context sort, so the reservation covers either inverse: 
+* the packed map, or the next rows and group marks of the sort transform. The sort transform has no sampled variant.
+*/
+size_t BlockSort::Bwt::InverseMemory(Index Len, Options Opt)
+{
+	if(LowMemory(Len, Opt))
+		return RankTableSize(Len);
+	size_t Map = (size_t)Len * ((Len < (1 << 24)) ? 4 : 5);
+	size_t St = (size_t)Len * (sizeof(Index) + 1);
+	return __max(Map, St);
+}
+
+/**
+* Every sampled index starts an independent chain which decodes 'step' symbols, the chains are split over the threads in contiguous ranges
+* and every thread interleaves all of its chains so many cache misses are in flight at once.
+* Returns JAM_OK, JAM_ERROR_CORRUPT if the tail or the sampled indices can't belong to the block, JAM_ERROR_VERSION for an unknown block format, 
+* or JAM_ERROR_MEMORY if the map or the rank tables can't be allocated.
+*/
+int BlockSort::Bwt::InverseBwt(Buffer Input, Buffer Output, Options Opt)
 {
 	int Threads = Opt.Threads;
 	unsigned char *Bwt = Input.block;
 	unsigned char *T = Output.block;
-	int Len = *Input.size -= (BWT_UNITS * sizeof(Index));
-	*Output.size = *Input.size;
 	
-	int remainder = Len % BWT_UNITS;
+	Index Units = BWT_LEGACY_UNITS;
+	int Order = 0;
+	if(Opt.BlockFormat == 0) // 0.80 blocks always end with BWT_LEGACY_UNITS indices of the full transform
+	{
+		if(*Input.size < (Index)(Units * sizeof(Index)))
+			return JAM_ERROR_CORRUPT;
+		*Input.size -= Units * sizeof(Index);
+	}
+	else if(Opt.BlockFormat == 1) // The unit count of the tail is a power of two chosen by BwtUnits
+	{
+		if(*Input.size < (Index)(sizeof(Index) + 1))
+			return JAM_ERROR_CORRUPT;
+		memcpy(&Units, &Bwt[*Input.size - 1 - sizeof(Index)], sizeof(Index));
+		if(Units < BWT_MIN_UNITS || Units > BWT_MAX_UNITS || (Units & (Units - 1)) != 0 || *Input.size < (Index)BWT_TAIL(Units))
+			return JAM_ERROR_CORRUPT;
+		Order = Bwt[*Input.size - 1];
+		if(Order != 0 && (Order < ST_MIN_ORDER || Order > ST_MAX_ORDER)) // Unknown sort transform
+			return JAM_ERROR_CORRUPT;
+		*Input.size -= BWT_TAIL(Units);
+	}
+	else
+		return JAM_ERROR_VERSION;
+	int Len = *Output.size = *Input.size;
+	
+	int remainder = Len % Units;
 	int nlen = Len - remainder;
 	for(int i = 0; i < remainder; i++)
 		T[nlen + i] = Bwt[nlen + i];
 	
 	if(nlen > 0)
 	{
-		Index Indicies[BWT_UNITS] = {0};
-		for(Index i = 0; i < BWT_UNITS; i++)
-			memcpy(&Indicies[i], &Bwt[Len + (i * sizeof(Index))], sizeof(Index));
-
-		// Adjust thread counts if necessary (shares the workload evenly)
-		int Units = 4;
-		int N_Units = Threads;
-
-		#ifdef __CUDACC__
-		bool InvertOnGPU = false;
+		size_t mark = Workspace->Mark();
+		Index *Indicies = Workspace->Alloc<Index>(Units);
+		if(Indicies == NULL)
+		{
+			Workspace->Release(mark);
+			return JAM_ERROR_MEMORY;
+		}
+		memcpy(Indicies, &Bwt[Len], Units * sizeof(Index));
 		
-		if(Opt.Gpu == true)
+		if(Order != 0)
 		{
-			if(CheckCudaSupport() == true)
-			{
-				uint64_t CudaMemory = GetCudaMemory();
-				if((CudaMemory * MAX_GPU_RESOURCES) > (nlen * (sizeof(Index) + (sizeof(unsigned char) * 2)))) // See if there's enough space to move everything to the GPU.
-				{
-					Units = 1;
-					uint64_t CudaCores = GetCudaCoreCount();
-					if(CudaCores >= BWT_UNITS)
-						N_Units = Threads = BWT_UNITS;
-					else
-						N_Units = Threads = CudaCores;
-					InvertOnGPU = true;
-				}
-			}
+			int Status = InverseSt(Bwt, T, nlen, Order, Units, Indicies, Threads);
+			Workspace->Release(mark);
+			return Status;
 		}
-		#endif
-		while ((BWT_UNITS % (N_Units * Units)) != 0)
+		
+		for(int i = 0; i < Units; i++) // Every chain starts on a row of the block
 		{
-			if ((N_Units * Units) >= BWT_UNITS)
+			if(Indicies[i] < 1 || Indicies[i] > nlen)
 			{
-				N_Units = Threads;
-				while ((BWT_UNITS % (N_Units * Units)) != 0)
-				{
-					if (N_Units <= 0) 
-						Error("Bwt :: Arithmetic error has occurred!");
-					N_Units--;
-				}
-				if((BWT_UNITS % (N_Units * Units)) == 0) break;
+				Workspace->Release(mark);
+				return JAM_ERROR_CORRUPT;
 			}
-			N_Units++;
 		}
-		N_Units *= Units;
-		Threads = N_Units / Units;
 		
-		// Compute all the necessities
-		Index* Map = (Index*)malloc(sizeof(Index) * nlen); 
-		if (Map == NULL) 
-			Error("Bwt :: Couldn't allocate index map!");
-			
+		if(Threads > Units) 
+			Threads = Units;
 		Index idx = Indicies[0];
+		Index step = nlen / Units;
 		
-		Index count[257] = {0};
+		if(LowMemory(nlen, Opt))
 		{
-			Index F[8][257] = {{0}};
-			int j = nlen;
-			while((j-8) > 0)
-			{
-				++F[0][Bwt[j-1]+1];
-				++F[1][Bwt[j-2]+1];
-				++F[2][Bwt[j-3]+1];
-				++F[3][Bwt[j-4]+1];
-				++F[4][Bwt[j-5]+1];
-				++F[5][Bwt[j-6]+1];
-				++F[6][Bwt[j-7]+1];
-				++F[7][Bwt[j-8]+1];
-				j-=8;
-			}
-			while(j > 0)
-			{
-				++F[0][Bwt[j-1]+1];
-				j--;
-			}
-			for(int k = 0; k < 257; k++)
-				F[0][k] = F[0][k] + F[1][k] + F[2][k] + F[3][k] + F[4][k] + F[5][k] + F[6][k] + F[7][k];
-			
-			for(int k = 0; k < 257; k++)
-				count[k]=  F[0][k];
+			int Status = InvertSampled(Bwt, T, nlen, idx, Indicies, step, Units, Threads);
+			Workspace->Release(mark);
+			return Status;
 		}
-		for (Index i = 1; i < 256; ++i) 
-			count[i] += count[i - 1];
 		
-		for (Index i = 0; i < idx; ++i)
-			Map[count[Bwt[i]]++] = i;
-		for (Index i = idx; i < nlen; ++i)
-			Map[count[Bwt[i]]++] = i + 1;			
-	
-		Index step = nlen / N_Units;
-		Index* p = new Index[N_Units]; 
-		Index* offset = new Index[N_Units]; 
-			
-		for (int i = 0; i < N_Units; i++) 
-			p[i] = Indicies[BWT_UNITS / N_Units * i];
-		for (int i = 0; i < N_Units; i++) 
-			offset[i] = step * i;
+		Index *Offsets = Workspace->Alloc<Index>(Threads * 256);
+		Index *p = Workspace->Alloc<Index>(Units); 
+		if(Offsets == NULL || p == NULL)
+		{
+			Workspace->Release(mark);
+			return JAM_ERROR_MEMORY;
+		}
+		SliceOffsets(Bwt, nlen, Threads, Offsets);
+		
+		// Low entropy blocks are inverted two symbols per step, on noisy blocks scattering the rows over up to 64K pairs costs more than the shorter walk saves
+		double Entropy = 0;
+		for(int c = 0; c < 256; c++)
+		{
+			Index f = ((c < 255) ? Offsets[c + 1] : nlen) - Offsets[c];
+			if(f > 0)
+				Entropy -= (double)f * log2((double)f / (double)nlen);
+		}
+		bool TwoSymbols = Entropy <= PAIR_MAX_ENTROPY * (double)nlen;
+		
+		for (int i = 0; i < Units; i++) 
+			p[i] = Indicies[i];
 
 		// INVERT 		
+		int Status = JAM_OK;
 		#ifdef __CUDACC__
+		bool InvertOnGPU = false;
+		if(Opt.Gpu == true && (Units % 32) == 0 && CheckCudaSupport() == true) // The 120 chains of a format 0 block don't fill whole GPU blocks, they stay on the cpu
+		{
+			uint64_t CudaMemory = GetCudaMemory();
+			// See if there's enough space to move everything to the GPU, every GPU thread runs one chain.
+			if((CudaMemory * MAX_GPU_RESOURCES) > (nlen * (sizeof(Index) + (sizeof(unsigned char) * 2))))
+				InvertOnGPU = true;
+		}
+		
 		if(InvertOnGPU == true)
 		{
+			Index count[256];
+			memcpy(count, Offsets, 256 * sizeof(Index)); // The first slice starts at the bucket starts
+			Threads = Units;
+			Index* Map = Workspace->Alloc<Index>(nlen); 
+			Index* offset = Workspace->Alloc<Index>(Units); 
+			if(Map == NULL || offset == NULL)
+			{
+				Workspace->Release(mark);
+				return JAM_ERROR_MEMORY;
+			}
+			for (Index i = 0; i < idx; ++i)
+				Map[count[Bwt[i]]++] = i;
+			for (Index i = idx; i < nlen; ++i)
+				Map[count[Bwt[i]]++] = i + 1;
+			for (int i = 0; i < Units; i++) 
+				offset[i] = step * i;
+			
 			unsigned char *d_Bwt;
 			unsigned char *d_T;
 			Index* d_p;
@@ -195,38 +320,21 @@ void BlockSort::Bwt::InverseBwt(Buffer Input, Buffer Output, Options Opt)
 			cudaCheck(cudaMalloc(&d_Bwt, sizeof(unsigned char) * nlen));
 			cudaCheck(cudaMalloc(&d_T, sizeof(unsigned char) * nlen));
 			cudaCheck(cudaMalloc(&d_Map, sizeof(Index) * nlen)); 
-			cudaCheck(cudaMalloc(&d_p, sizeof(Index) * N_Units));
-			cudaCheck(cudaMalloc(&d_offset, sizeof(Index) * N_Units));
+			cudaCheck(cudaMalloc(&d_p, sizeof(Index) * Units));
+			cudaCheck(cudaMalloc(&d_offset, sizeof(Index) * Units));
 			
 			cudaCheck(cudaMemcpy(d_Bwt, Bwt, sizeof(unsigned char) * nlen, cudaMemcpyHostToDevice));			
 			cudaCheck(cudaMemcpy(d_T, T, sizeof(unsigned char) * nlen, cudaMemcpyHostToDevice));
 			cudaCheck(cudaMemcpy(d_Map, Map, sizeof(Index) * nlen, cudaMemcpyHostToDevice));
-			cudaCheck(cudaMemcpy(d_p, p, sizeof(Index) * N_Units, cudaMemcpyHostToDevice));
-			cudaCheck(cudaMemcpy(d_offset, offset, sizeof(Index) * N_Units, cudaMemcpyHostToDevice));
+			cudaCheck(cudaMemcpy(d_p, p, sizeof(Index) * Units, cudaMemcpyHostToDevice));
+			cudaCheck(cudaMemcpy(d_offset, offset, sizeof(Index) * Units, cudaMemcpyHostToDevice));
 			
-			int TryUnits = 32;
-			int CudaUnits = TryUnits;
-			
-			while ((Threads % CudaUnits) != 0)
-			{
-				if (CudaUnits >= BWT_UNITS)
-				{
-					CudaUnits = TryUnits;
-					while ((Threads % CudaUnits) != 0)
-					{
-						if (CudaUnits <= 0) 
-							Error("Bwt :: Arithmetic error has occurred!");
-						CudaUnits--;
-					}
-					if((Threads % CudaUnits) == 0) break;
-				}
-				CudaUnits++;
-			}
+			int CudaUnits = 32; // Threads per GPU block, the unit count of format 1 blocks is a power of two so this always divides it
 			
-			dim3 dimGrid(CudaUnits);
-			dim3 dimBlock(Threads/CudaUnits);
+			dim3 dimGrid(Threads / CudaUnits);
+			dim3 dimBlock(CudaUnits);
 			
-			CUDAInverse<<<dimGrid, dimBlock>>>(Threads, CudaUnits, d_Bwt, d_T, step, &d_p[0], idx, d_Map, &d_offset[0]);
+			CUDAInverse<<<dimGrid, dimBlock>>>(Threads, Threads / CudaUnits, d_Bwt, d_T, step, &d_p[0], idx, d_Map, &d_offset[0]);
 			
 			cudaDeviceSynchronize(); // wait for gpu to finish 
 			
@@ -240,43 +348,679 @@ void BlockSort::Bwt::InverseBwt(Buffer Input, Buffer Output, Options Opt)
 		}
 		else
 		{
-			#pragma omp parallel for num_threads(Threads) 
-			for(int n = 0; n < Threads; n++) // Threaded
-			{
-				int start = n * Units;
-				int end = (n + 1) * Units;
-				for (int i = 0; i != step; i++) // OoOE
-				{
-					for (int j = start; j != end; j++) // Worker loop
-					{
-						p[j] = Map[p[j] - 1];
-						T[i + offset[j]] = Bwt[p[j] - (p[j] >= idx)];
-					}
-				}
-			}
+			if(TwoSymbols)
+				Status = InvertPairs(Bwt, T, nlen, idx, Offsets, p, step, Units, Threads);
+			else
+				Status = InvertPacked(Bwt, T, nlen, idx, Offsets, p, step, Units, Threads);
 		}
 		#endif
 
 		#ifndef __CUDACC__
+		if(TwoSymbols)
+			Status = InvertPairs(Bwt, T, nlen, idx, Offsets, p, step, Units, Threads);
+		else
+			Status = InvertPacked(Bwt, T, nlen, idx, Offsets, p, step, Units, Threads);
+		#endif
+		
+		Workspace->Release(mark);
+		return Status;
+	}
+	return JAM_OK;
+}
+
+/**
+* Walk the chains [start, end) of a thread through the 32-bit packed map, 'step' symbols each
+*/
+static void WalkPacked(const uint32_t *Map, unsigned char *T, Index *p, int start, int end, Index step)
+{
+	for (Index i = 0; i != step; i++)
+	{
+		for (int j = start; j != end; j++)
+		{
+			uint32_t e = Map[p[j] - 1];
+			p[j] = e >> 8;
+			T[j * step + i] = (unsigned char)e;
+		}
+	}
+}
+
+/**
+* Eight chains per gather, the low bytes of the entries are the symbols of the eight chains.
+*/
+TARGET_AVX2 static void WalkPackedAvx2(const uint32_t *Map, unsigned char *T, Index *p, int start, int end, Index step)
+{
+	const __m256i One = _mm256_set1_epi32(1);
+	const __m256i LowBytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 
+						0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	for (Index i = 0; i != step; i++)
+	{
+		int j = start;
+		for (; j + 8 <= end; j += 8)
+		{
+			__m256i r = _mm256_loadu_si256((const __m256i*)&p[j]);
+			__m256i e = _mm256_i32gather_epi32((const int*)Map, _mm256_sub_epi32(r, One), 4);
+			_mm256_storeu_si256((__m256i*)&p[j], _mm256_srli_epi32(e, 8));
+			
+			__m256i s = _mm256_shuffle_epi8(e, LowBytes);
+			uint32_t lo = _mm_cvtsi128_si32(_mm256_castsi256_si128(s));
+			uint32_t hi = _mm_cvtsi128_si32(_mm256_extracti128_si256(s, 1));
+			unsigned char *out = &T[j * step + i];
+			for (int k = 0; k < 4; k++)
+			{
+				out[k * step] = (unsigned char)(lo >> (k * 8));
+				out[(k + 4) * step] = (unsigned char)(hi >> (k * 8));
+			}
+		}
+		for (; j != end; j++)
+		{
+			uint32_t e = Map[p[j] - 1];
+			p[j] = e >> 8;
+			T[j * step + i] = (unsigned char)e;
+		}
+	}
+}
+
+/**
+* The LF-mapping is stored together with the symbol it leads to, so a step of a chain is one random access instead of two.
+* Blocks below 16 MB use 32-bit entries (24-bit index, 8-bit symbol), larger blocks use 40-bit entries read with an unaligned 64-bit load.
+* The map is scattered in parallel, every thread fills in its slice of the block from its own offsets (see SliceOffsets).
+* Returns JAM_OK, or JAM_ERROR_MEMORY if the map can't be allocated.
+*/
+int BlockSort::Bwt::InvertPacked(unsigned char *Bwt, unsigned char *T, Index nlen, Index idx, Index *Offsets, Index *p, Index step, Index Units, int Threads)
+{
+	if(nlen < (1 << 24))
+	{
+		uint32_t *Map = Workspace->Alloc<uint32_t>(nlen);
+		if(Map == NULL)
+			return JAM_ERROR_MEMORY;
+		#pragma omp parallel for num_threads(Threads)
+		for(int n = 0; n < Threads; n++)
+		{
+			Index *count = &Offsets[n * 256];
+			Index start = (Index)((int64_t)nlen * n / Threads);
+			Index end = (Index)((int64_t)nlen * (n + 1) / Threads);
+			for (Index i = start; i < end; ++i)
+				Map[count[Bwt[i]]++] = ((uint32_t)(i + (i >= idx)) << 8) | Bwt[i];
+		}
+		
 		#pragma omp parallel for num_threads(Threads)
+		for(int n = 0; n < Threads; n++)
+		{
+			int start = Units * n / Threads;
+			int end = Units * (n + 1) / Threads;
+			if(Simd == SIMD_AVX2)
+				WalkPackedAvx2(Map, T, p, start, end, step);
+			else
+				WalkPacked(Map, T, p, start, end, step);
+		}
+	}
+	else
+	{
+		unsigned char *Map = Workspace->Alloc<unsigned char>((size_t)nlen * 5 + 8); // Slack for the 64-bit load of the last entry
+		if(Map == NULL)
+			return JAM_ERROR_MEMORY;
+		#pragma omp parallel for num_threads(Threads)
+		for(int n = 0; n < Threads; n++)
+		{
+			Index *count = &Offsets[n * 256];
+			Index start = (Index)((int64_t)nlen * n / Threads);
+			Index end = (Index)((int64_t)nlen * (n + 1) / Threads);
+			for (Index i = start; i < end; ++i)
+			{
+				uint64_t e = ((uint64_t)(i + (i >= idx)) << 8) | Bwt[i];
+				memcpy(&Map[(size_t)count[Bwt[i]]++ * 5], &e, 5);
+			}
+		}
 		
+		#pragma omp parallel for num_threads(Threads)
 		for(int n = 0; n < Threads; n++)
 		{
-			int start = n * Units;
-			int end = (n + 1) * Units;
-			for (int i = 0; i != step; i++)
+			int start = Units * n / Threads;
+			int end = Units * (n + 1) / Threads;
+			for (Index i = 0; i != step; i++)
 			{
 				for (int j = start; j != end; j++)
 				{
-					p[j] = Map[p[j] - 1]; 
-					T[i + offset[j]] = Bwt[p[j] - (p[j] >= idx)];
+					uint64_t e;
+					memcpy(&e, &Map[(size_t)(p[j] - 1) * 5], sizeof(uint64_t));
+					p[j] = (Index)((e >> 8) & 0xffffffff);
+					T[j * step + i] = (unsigned char)e;
 				}
 			}
 		}
-		#endif
-		
-		delete[] p;
-		delete[] offset;
-		free(Map);
 	}
+	return JAM_OK;
+}
+
+/**
+* Tables of the two symbols per step inverse (see InvertPairs)
+*/
+struct PairTables
+{
+	const Index *Map;		// Row two suffixes ahead
+	const uint16_t *Fast;		// First pair of every slot of rows
+	int Shift;			// Rows per slot
+	const Index *Start;		// First row of every pair which occurs, followed by the row count
+	const uint16_t *Gram;		// The pairs which occur, first symbol in the high byte
+};
+
+/**
+* Walk the chains [start, end) of a thread two symbols per step, the last symbol of an odd step is left to the caller
+*/
+static void WalkPairs(const PairTables &P, unsigned char *T, Index *p, int start, int end, Index step)
+{
+	for (Index i = 0; i + 1 < step; i += 2)
+	{
+		for (int j = start; j != end; j++)
+		{
+			Index r = p[j];
+			int g = P.Fast[r >> P.Shift];
+			while(P.Start[g + 1] <= r)
+				g++;
+			T[j * step + i] = (unsigned char)(P.Gram[g] >> 8);
+			T[j * step + i + 1] = (unsigned char)P.Gram[g];
+			p[j] = P.Map[r];
+		}
+	}
+}
+
+/**
+* Eight chains at once, the scan over the pair ranges repeats until no lane moves (rarely more than once on low entropy blocks).
+* The 16-bit tables are gathered as 32-bit and masked, they have one entry of padding.
+*/
+TARGET_AVX2 static void WalkPairsAvx2(const PairTables &P, unsigned char *T, Index *p, int start, int end, Index step)
+{
+	const __m256i One = _mm256_set1_epi32(1);
+	const __m256i Low16 = _mm256_set1_epi32(0xffff);
+	const __m128i Shift = _mm_cvtsi32_si128(P.Shift);
+	const __m256i Swap = _mm256_setr_epi8(1, 0, 5, 4, 9, 8, 13, 12, -1, -1, -1, -1, -1, -1, -1, -1, 
+						1, 0, 5, 4, 9, 8, 13, 12, -1, -1, -1, -1, -1, -1, -1, -1);
+	for (Index i = 0; i + 1 < step; i += 2)
+	{
+		int j = start;
+		for (; j + 8 <= end; j += 8)
+		{
+			__m256i r = _mm256_loadu_si256((const __m256i*)&p[j]);
+			__m256i g = _mm256_and_si256(_mm256_i32gather_epi32((const int*)P.Fast, _mm256_srl_epi32(r, Shift), 2), Low16);
+			while(1)
+			{
+				__m256i next = _mm256_i32gather_epi32((const int*)P.Start, _mm256_add_epi32(g, One), 4);
+				__m256i move = _mm256_cmpgt_epi32(_mm256_add_epi32(r, One), next); // Start[g + 1] <= r
+				if(_mm256_testz_si256(move, move))
+					break;
+				g = _mm256_sub_epi32(g, move);
+			}
+			__m256i gram = _mm256_i32gather_epi32((const int*)P.Gram, g, 2);
+			_mm256_storeu_si256((__m256i*)&p[j], _mm256_i32gather_epi32((const int*)P.Map, r, 4));
+			
+			uint16_t pairs[8]; // Symbols in output order
+			__m256i s = _mm256_shuffle_epi8(gram, Swap);
+			_mm_storel_epi64((__m128i*)&pairs[0], _mm256_castsi256_si128(s));
+			_mm_storel_epi64((__m128i*)&pairs[4], _mm256_extracti128_si256(s, 1));
+			for (int k = 0; k < 8; k++)
+				memcpy(&T[(j + k) * step + i], &pairs[k], 2);
+		}
+		for (; j != end; j++)
+		{
+			Index r = p[j];
+			int g = P.Fast[r >> P.Shift];
+			while(P.Start[g + 1] <= r)
+				g++;
+			T[j * step + i] = (unsigned char)(P.Gram[g] >> 8);
+			T[j * step + i + 1] = (unsigned char)P.Gram[g];
+			p[j] = P.Map[r];
+		}
+	}
+}
+
+/**
+* Two symbols per step: the map jumps two suffixes ahead, and the pair of symbols a row starts with is found from the row itself 
+* since rows are sorted and every pair owns a contiguous range of them.
+* The map is built in two scans over the block. The first finds the symbol before every symbol through the LF-mapping 
+* (a read of the block which is close to sequential on compressible data) and counts the pairs, 
+* the second scatters every row to the next free row of the pair it is preceded by. The output buffer holds the preceding symbols in between.
+* Row 0 is the sentinel, the last suffix of the block (the last symbol followed by the sentinel) sorts first among its symbol.
+* Returns JAM_OK, or JAM_ERROR_MEMORY if the map or the pair tables can't be allocated.
+*/
+int BlockSort::Bwt::InvertPairs(unsigned char *Bwt, unsigned char *T, Index nlen, Index idx, Index *Offsets, Index *p, Index step, Index Units, int Threads)
+{
+	Index *Pairs = Workspace->Alloc<Index>((size_t)Threads * 65536);
+	Index *Map = Workspace->Alloc<Index>((size_t)nlen + 1);
+	Index *Start = Workspace->Alloc<Index>(65536 + 1);
+	uint16_t *Gram = Workspace->Alloc<uint16_t>(65536 + 1); // The vector walk reads entries as 32-bit
+	if(Pairs == NULL || Map == NULL || Start == NULL || Gram == NULL)
+		return JAM_ERROR_MEMORY;
+	unsigned char *Prev = T;
+	Index Second = nlen; // The symbol of suffix 1 is preceded by the sentinel and starts no pair
+	
+	#pragma omp parallel for num_threads(Threads)
+	for(int n = 0; n < Threads; n++)
+	{
+		Index *count = &Offsets[n * 256];
+		Index *pairs = &Pairs[(size_t)n * 65536];
+		Index start = (Index)((int64_t)nlen * n / Threads);
+		Index end = (Index)((int64_t)nlen * (n + 1) / Threads);
+		memset(pairs, 0, 65536 * sizeof(Index));
+		for (Index i = start; i < end; ++i)
+		{
+			unsigned char c = Bwt[i];
+			Index lf = count[c]++ + 1;
+			if(lf == idx)
+			{
+				Second = i;
+				continue;
+			}
+			unsigned char a = Bwt[lf - (lf > idx)];
+			Prev[i] = a;
+			pairs[(a << 8) | c]++;
+		}
+	}
+	
+	// Starting rows of every pair in every slice, and the ranges of the pairs which occur for the lookup
+	int Grams = 0;
+	Index row = 1;
+	for(int g = 0; g < 65536; g++)
+	{
+		Index first = row;
+		if(g == (Bwt[0] << 8))
+			row++;
+		for(int n = 0; n < Threads; n++)
+		{
+			Index c = Pairs[(size_t)n * 65536 + g];
+			Pairs[(size_t)n * 65536 + g] = row;
+			row += c;
+		}
+		if(row > first)
+		{
+			Start[Grams] = first;
+			Gram[Grams++] = g;
+		}
+	}
+	Start[Grams] = row;
+	
+	#pragma omp parallel for num_threads(Threads)
+	for(int n = 0; n < Threads; n++)
+	{
+		Index *pairs = &Pairs[(size_t)n * 65536];
+		Index start = (Index)((int64_t)nlen * n / Threads);
+		Index end = (Index)((int64_t)nlen * (n + 1) / Threads);
+		for (Index i = start; i < end; ++i)
+			if(i != Second)
+				Map[pairs[(Prev[i] << 8) | Bwt[i]]++] = i + (i >= idx);
+	}
+	
+	// Every slot of the lookup names the first pair of its rows, a step scans forward from there over the pairs which occur
+	int Shift = 0;
+	while(((nlen + 1) >> Shift) >= 65536)
+		Shift++;
+	Index Slots = ((nlen + 1) >> Shift) + 1;
+	uint16_t *Fast = Workspace->Alloc<uint16_t>(Slots + 1);
+	if(Fast == NULL)
+		return JAM_ERROR_MEMORY;
+	int k = 0;
+	for(Index s = 0; s < Slots; s++)
+	{
+		while(k + 1 < Grams && Start[k + 1] <= (s << Shift))
+			k++;
+		Fast[s] = k;
+	}
+	PairTables Tables = { Map, Fast, Shift, Start, Gram };
+	
+	#pragma omp parallel for num_threads(Threads)
+	for(int n = 0; n < Threads; n++)
+	{
+		int start = Units * n / Threads;
+		int end = Units * (n + 1) / Threads;
+		if(Simd == SIMD_AVX2)
+			WalkPairsAvx2(Tables, T, p, start, end, step);
+		else
+			WalkPairs(Tables, T, p, start, end, step);
+		if(step & 1)
+		{
+			for (int j = start; j != end; j++)
+			{
+				Index r = p[j];
+				int g = Fast[r >> Shift];
+				while(Start[g + 1] <= r)
+					g++;
+				T[j * step + step - 1] = (unsigned char)(Gram[g] >> 8);
+			}
+		}
+	}
+	return JAM_OK;
+}
+
+/**
+* Occurrences of 'c' in p[0, len), len is below 4 KB so the byte-wise counters can't wrap before they are summed.
+*/
+static inline Index CountSymbol(const unsigned char *p, Index len, unsigned char c)
+{
+	Index i = 0;
+	Index n = 0;
+#ifdef HAVE_SSE2
+	const __m128i v = _mm_set1_epi8((char)c);
+	__m128i acc = _mm_setzero_si128();
+	for(; i + 16 <= len; i += 16)
+		acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&p[i]), v));
+	acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+	n = _mm_cvtsi128_si32(acc) + _mm_extract_epi16(acc, 4);
+#endif
+	for(; i < len; i++)
+		n += (p[i] == c);
+	return n;
+}
+
+/**
+* Low memory inverse, the block is decoded backwards with the LF-mapping computed from sampled symbol counts instead of a map of the whole block.
+* Counts are kept at every 1 KB (16-bit, relative to the 64 KB superblock) which costs N/2 bytes, 
+* a rank is a checkpoint plus a count over the nearer half of its 1 KB block.
+* Chain j starts at the row of the sample after it (the row of the sentinel for the last chain) and writes its 'step' symbols from the end.
+* Returns JAM_OK, or JAM_ERROR_MEMORY if the rank tables can't be allocated.
+*/
+int BlockSort::Bwt::InvertSampled(unsigned char *Bwt, unsigned char *T, Index nlen, Index idx, Index *Indicies, Index step, Index Units, int Threads)
+{
+	const Index BlockLen = 1 << RANK_BLOCK_SHIFT;
+	const int BlocksPerSuper = 1 << (RANK_SUPER_SHIFT - RANK_BLOCK_SHIFT);
+	Index Blocks = (nlen >> RANK_BLOCK_SHIFT) + 1;
+	Index Supers = (nlen >> RANK_SUPER_SHIFT) + 1;
+	uint16_t *Occ = Workspace->Alloc<uint16_t>((size_t)Blocks * 256);
+	Index *SuperOcc = Workspace->Alloc<Index>((size_t)(Supers + 1) * 256);
+	Index *p = Workspace->Alloc<Index>(Units);
+	if(Occ == NULL || SuperOcc == NULL || p == NULL)
+		return JAM_ERROR_MEMORY;
+	
+	// Counts within every superblock in parallel, the superblock totals are summed up afterwards
+	#pragma omp parallel for num_threads(Threads)
+	for(int k = 0; k < Supers; k++)
+	{
+		Index count[256] = {0};
+		Index first = k * BlocksPerSuper;
+		Index last = __min(first + BlocksPerSuper, Blocks);
+		for(Index j = first; j < last; j++)
+		{
+			for(int c = 0; c < 256; c++)
+				Occ[j * 256 + c] = (uint16_t)count[c];
+			Index end = __min((j + 1) * BlockLen, nlen);
+			for(Index i = j * BlockLen; i < end; i++)
+				count[Bwt[i]]++;
+		}
+		memcpy(&SuperOcc[(k + 1) * 256], count, 256 * sizeof(Index));
+	}
+	memset(SuperOcc, 0, 256 * sizeof(Index));
+	for(Index k = 1; k <= Supers; k++)
+		for(int c = 0; c < 256; c++)
+			SuperOcc[k * 256 + c] += SuperOcc[(k - 1) * 256 + c];
+	
+	Index C[256]; // First row of every symbol, row 0 belongs to the sentinel
+	Index sum = 1;
+	for(int c = 0; c < 256; c++)
+	{
+		C[c] = sum;
+		sum += SuperOcc[Supers * 256 + c];
+	}
+	
+	for(Index j = 0; j < Units; j++)
+		p[j] = (j + 1 < Units) ? Indicies[j + 1] : 0;
+	
+	#pragma omp parallel for num_threads(Threads)
+	for(int n = 0; n < Threads; n++)
+	{
+		int start = Units * n / Threads;
+		int end = Units * (n + 1) / Threads;
+		for (Index i = step; i-- != 0;)
+		{
+			for (int j = start; j != end; j++)
+			{
+				Index b = p[j] - (p[j] > idx);
+				unsigned char c = Bwt[b];
+				T[j * step + i] = c;
+				
+				Index blk = b >> RANK_BLOCK_SHIFT;
+				Index r = b & (BlockLen - 1);
+				Index rank;
+				if(r < (BlockLen >> 1) || (blk + 1) * BlockLen > nlen)
+					rank = SuperOcc[(blk / BlocksPerSuper) * 256 + c] + Occ[blk * 256 + c] + CountSymbol(&Bwt[b - r], r, c);
+				else
+					rank = SuperOcc[((blk + 1) / BlocksPerSuper) * 256 + c] + Occ[(blk + 1) * 256 + c] - CountSymbol(&Bwt[b], BlockLen - r, c);
+				p[j] = C[c] + rank;
+				#ifdef HAVE_SSE2
+				_mm_prefetch((const char*)&Bwt[p[j]], _MM_HINT_T0); // The chain only comes back to it a round later
+				#endif
+			}
+		}
+	}
+	return JAM_OK;
+}
+
+/**
+* Limited context sort (Schindler transform): every symbol is sorted by the 'Order' symbols preceding it, ties stay in text order.
+* The block is cut into segments which are transformed on their own (contexts wrap around inside a segment), 
+* the slot of a segment in Indicies holds the row of its first symbol.
+* Segments are at least ST_MIN_SEGMENT long and their count is a power of two up to the unit count, so it divides the length 
+* and both sides derive the same layout.
+*/
+static int StSegments(Index Len, Index Units)
+{
+	int Segments = 1;
+	while((Segments << 1) <= Units && (Len / (Segments << 1)) >= ST_MIN_SEGMENT)
+		Segments <<= 1;
+	return Segments;
+}
+
+static inline Index StWrap(Index i, Index Len)
+{
+	return (i < 0) ? i + Len : i;
+}
+
+/**
+* Sort one segment with a least significant digit first radix sort, two context symbols per pass.
+* The histogram of symbol pairs is the same for every pass since contexts wrap around, so it's only counted once.
+* Work holds two row arrays of Len and 2 * 65536 + 256 counters. Returns the row of the first symbol.
+*/
+static Index StSortSegment(const unsigned char *T, unsigned char *L, Index Len, int Order, Index *Work)
+{
+	Index *Src = Work;
+	Index *Dst = Work + Len;
+	Index *Pairs = Work + 2 * Len;
+	Index *Bucket = Pairs + 65536;
+	Index *Symbols = Bucket + 65536;
+	
+	memset(Pairs, 0, 65536 * sizeof(Index));
+	memset(Symbols, 0, 256 * sizeof(Index));
+	for(Index i = 0; i < Len; i++)
+	{
+		Pairs[(T[i] << 8) | T[StWrap(i - 1, Len)]]++;
+		Symbols[T[i]]++;
+	}
+	for(Index i = 0; i < Len; i++)
+		Src[i] = i;
+	
+	int d = Order;
+	if(Order & 1) // Odd orders start with a single symbol pass on the farthest context symbol
+	{
+		for(Index c = 0, sum = 0; c < 256; c++) 
+		{ 
+			Bucket[c] = sum; 
+			sum += Symbols[c]; 
+		}
+		for(Index r = 0; r < Len; r++)
+		{
+			Index i = Src[r];
+			Dst[Bucket[T[StWrap(i - d, Len)]]++] = i;
+		}
+		Index *t = Src; Src = Dst; Dst = t;
+		d--;
+	}
+	for(; d > 0; d -= 2) // Symbols at distance d - 1 and d make up one digit, the nearer one is more significant
+	{
+		for(Index c = 0, sum = 0; c < 65536; c++) 
+		{ 
+			Bucket[c] = sum; 
+			sum += Pairs[c]; 
+		}
+		for(Index r = 0; r < Len; r++)
+		{
+			Index i = Src[r];
+			Index j = StWrap(i - d + 1, Len);
+			Dst[Bucket[(T[j] << 8) | T[StWrap(j - 1, Len)]]++] = i;
+		}
+		Index *t = Src; Src = Dst; Dst = t;
+	}
+	
+	Index Primary = 0;
+	for(Index r = 0; r < Len; r++)
+	{
+		Index i = Src[r];
+		L[r] = T[i];
+		if(i == 0)
+			Primary = r;
+	}
+	return Primary;
+}
+
+/**
+* Decoding walks the text forward, the rows of a context are used in text order so each context only needs a counter of its used rows.
+* The rows of the context following a row are found without the text: rows with c preceding symbols in common, 
+* followed by symbol 'a', make up the rows with c + 1 preceding symbols in common starting with 'a' (the same idea as the LF-mapping).
+* So the groups of Order - 1 symbols are refined from the groups of one symbol, and the first 'a' of each group points at the start of its successor context.
+* On return Next holds the start of the next context of every row, Mark is Len bytes of scratch for the group boundaries.
+*/
+static void StPrepareSegment(const unsigned char *L, Index Len, int Order, Index *Next, unsigned char *Mark)
+{
+	Index *Group = Next;
+	
+	Index Count[257] = {0};
+	for(Index r = 0; r < Len; r++)
+		Count[L[r] + 1]++;
+	for(int c = 0; c < 256; c++)
+		Count[c + 1] += Count[c];
+	
+	for(int c = 0; c < 256; c++)
+		for(Index r = Count[c]; r < Count[c + 1]; r++)
+			Group[r] = Count[c];
+	
+	Index Pos[256], Last[256], First[256];
+	for(int pass = 1; pass < Order - 1; pass++)
+	{
+		memcpy(Pos, Count, 256 * sizeof(Index));
+		for(int c = 0; c < 256; c++)
+			Last[c] = -1;
+		memset(Mark, 0, Len);
+		for(Index r = 0; r < Len; r++)
+		{
+			unsigned char c = L[r];
+			if(Group[r] != Last[c])
+			{
+				Mark[Pos[c]] = 1;
+				Last[c] = Group[r];
+			}
+			Pos[c]++;
+		}
+		for(Index r = 0; r < Len; r++)
+			Group[r] = Mark[r] ? r : Group[r - 1];
+	}
+	
+	memcpy(Pos, Count, 256 * sizeof(Index));
+	for(int c = 0; c < 256; c++)
+		Last[c] = -1;
+	for(Index r = 0; r < Len; r++)
+	{
+		unsigned char c = L[r];
+		if(Group[r] != Last[c])
+		{
+			First[c] = Pos[c];
+			Last[c] = Group[r];
+		}
+		Pos[c]++;
+		Group[r] = First[c];
+	}
+}
+
+/**
+* Returns false if the row arrays can't be allocated
+*/
+bool BlockSort::Bwt::ForwardSt(unsigned char *T, unsigned char *L, Index Len, int Order, Index Units, Index *Indicies, int Threads)
+{
+	int Segments = StSegments(Len, Units);
+	Index Step = Len / Segments;
+	if(Threads > Segments) Threads = Segments;
+	if(Threads < 1) Threads = 1;
+	
+	size_t mark = Workspace->Mark();
+	size_t Slab = 2 * (size_t)Step + 2 * 65536 + 256;
+	Index *Work = Workspace->Alloc<Index>(Slab * Threads);
+	if(Work == NULL)
+	{
+		Workspace->Release(mark);
+		return false;
+	}
+	
+	#pragma omp parallel for num_threads(Threads) schedule(dynamic, 1)
+	for(int s = 0; s < Segments; s++)
+		Indicies[s] = StSortSegment(&T[s * Step], &L[s * Step], Step, Order, &Work[Slab * omp_get_thread_num()]);
+	
+	Workspace->Release(mark);
+	return true;
+}
+
+/**
+* Returns JAM_OK, JAM_ERROR_CORRUPT if a segment index is out of range, or JAM_ERROR_MEMORY if the row arrays can't be allocated
+*/
+int BlockSort::Bwt::InverseSt(unsigned char *L, unsigned char *T, Index Len, int Order, Index Units, Index *Indicies, int Threads)
+{
+	int Segments = StSegments(Len, Units);
+	Index Step = Len / Segments;
+	if(Threads > Segments) Threads = Segments;
+	if(Threads < 1) Threads = 1;
+	
+	for(int s = 0; s < Segments; s++)
+		if(Indicies[s] < 0 || Indicies[s] >= Step) // Corrupt sort transform index
+			return JAM_ERROR_CORRUPT;
+	
+	size_t mark = Workspace->Mark();
+	Index *Next = Workspace->Alloc<Index>(Len);
+	unsigned char *Marks = Workspace->Alloc<unsigned char>((size_t)Step * Threads);
+	Index *Row = Workspace->Alloc<Index>(Segments);
+	if(Next == NULL || Marks == NULL || Row == NULL)
+	{
+		Workspace->Release(mark);
+		return JAM_ERROR_MEMORY;
+	}
+	
+	#pragma omp parallel for num_threads(Threads) schedule(dynamic, 1)
+	for(int s = 0; s < Segments; s++)
+		StPrepareSegment(&L[s * Step], Step, Order, &Next[s * Step], &Marks[(size_t)Step * omp_get_thread_num()]);
+	
+	// Every walk is one long chain of dependent loads, a thread steps all of its segments together to keep several misses in flight.
+	// Every row is walked once and a context is entered at its first row, so once that row is walked its entry is free 
+	// and holds the used rows of the context instead, flagged by the sign bit which no row number uses.
+	#pragma omp parallel for num_threads(Threads)
+	for(int n = 0; n < Threads; n++)
+	{
+		int start = Segments * n / Threads;
+		int end = Segments * (n + 1) / Threads;
+		for(int s = start; s < end; s++)
+			Row[s] = Indicies[s];
+		for(Index i = 0; i < Step; i++)
+		{
+			for(int s = start; s < end; s++)
+			{
+				Index *Rows = &Next[s * Step];
+				Index r = Row[s];
+				T[s * Step + i] = L[s * Step + r];
+				Index next = Rows[r];
+				Rows[r] = INT32_MIN | 1; // Only read again if r starts a context, which is then entered here
+				Index used = Rows[next];
+				if(used < 0)
+				{
+					Rows[next] = used + 1;
+					next += used & INT32_MAX;
+				}
+				Row[s] = next;
+			}
+		}
+	}
+	
+	Workspace->Release(mark);
+	return JAM_OK;
 }
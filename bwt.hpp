@@ -1,5 +1,9 @@
 /*********************************************
 * Asymmetric Burrows Wheeler Transform
+*
+* The block is followed by its sampled indices (a power of two between BWT_MIN_UNITS and BWT_MAX_UNITS chosen from the block size), 
+* their count, and one byte naming the transform: 0 is the full transform, 3 to 8 is a limited context sort (Schindler transform) of that order.
+* Blocks of format 0 (see BLOCK_FORMAT) only have BWT_LEGACY_UNITS indices of the full transform behind them.
 **********************************************/
 #ifndef BWT_H
 #define BWT_H
@@ -7,14 +11,27 @@
 #include "format.hpp"
 #include "divsufsort.hpp"
 #include "sys_detect.hpp"
+#include "arena.hpp"
 
 namespace BlockSort
 {
 	class Bwt
 	{
 		public:
-		void ForwardBwt(Buffer Input, Buffer Output);
-		void InverseBwt(Buffer Input, Buffer Output, Options Opt);
+		Bwt(Arena *Scratch);
+		int ForwardBwt(Buffer Input, Buffer Output, Options Opt);	// JAM_OK or JAM_ERROR_MEMORY
+		int InverseBwt(Buffer Input, Buffer Output, Options Opt);	// JAM_OK, JAM_ERROR_CORRUPT, JAM_ERROR_VERSION, or JAM_ERROR_MEMORY
+		static bool LowMemory(Index Len, Options Opt);		// Invert a block of Len bytes with sampled rank tables instead of the full map
+		static size_t InverseMemory(Index Len, Options Opt);	// Workspace the inverse of a block of Len bytes borrows
+		
+		private:
+		Arena *Workspace; 			// Suffix array and index map are borrowed from the instance arena
+		int Simd;				// Chain walk kernel picked from GetSimdLevel() at construction
+		int InvertPacked(unsigned char *Bwt, unsigned char *T, Index nlen, Index idx, Index *Offsets, Index *p, Index step, Index Units, int Threads);
+		int InvertPairs(unsigned char *Bwt, unsigned char *T, Index nlen, Index idx, Index *Offsets, Index *p, Index step, Index Units, int Threads);
+		int InvertSampled(unsigned char *Bwt, unsigned char *T, Index nlen, Index idx, Index *Indicies, Index step, Index Units, int Threads);
+		bool ForwardSt(unsigned char *T, unsigned char *L, Index Len, int Order, Index Units, Index *Indicies, int Threads);
+		int InverseSt(unsigned char *L, unsigned char *T, Index Len, int Order, Index Units, Index *Indicies, int Threads);
 	};
 	#ifdef __CUDACC__
 	__global__ void CUDAInverse(int Threads, int Units, unsigned char *Bwt, unsigned char *T, int Step, Index *p, Index Idx, Index* MAP, int *Offset);
@@ -1426,7 +1426,7 @@ static
 int
 sort_typeBstar(const unsigned char *T, int *SA,
                int *bucket_A, int *bucket_B,
-               int n) {
+               int n, int threads) {
   int *PAb, *ISAb, *buf;
 #ifdef _OPENMP
   int *curbuf;
@@ -1490,10 +1490,9 @@ note:
 
     /* Sort the type B* substrings using sssort. */
 #ifdef _OPENMP
-    tmp = omp_get_max_threads();
-    buf = SA + m, bufsize = (n - (2 * m)) / tmp;
+    buf = SA + m, bufsize = (n - (2 * m)) / threads;
     c0 = ALPHABET_SIZE - 2, c1 = ALPHABET_SIZE - 1, j = m;
-#pragma omp parallel default(shared) private(curbuf, k, l, d0, d1, tmp)
+#pragma omp parallel num_threads(threads) default(shared) private(curbuf, k, l, d0, d1, tmp)
     {
       tmp = omp_get_thread_num();
       curbuf = buf + tmp * bufsize;
@@ -1519,6 +1518,7 @@ note:
       }
     }
 #else
+    (void)threads;
     buf = SA + m, bufsize = n - (2 * m);
     for(c0 = ALPHABET_SIZE - 2, j = m; 0 < j; --c0) {
       for(c1 = ALPHABET_SIZE - 1; c0 < c1; j = i, --c1) {
@@ -1713,12 +1713,112 @@ construct_BWT(const unsigned char *T, int *SA,
 }
 
 
+/* Constructs the burrows-wheeler transformed string, and records the position
+   of every suffix which is a multiple of step along the way. */
+static
+int
+construct_BWT_sampled(const unsigned char *T, int *SA,
+                      int *bucket_A, int *bucket_B,
+                      int n, int m, int step, int *samples) {
+  int *i, *j, *k, *orig;
+  int s;
+  int c0, c1, c2;
+
+  if(0 < m) {
+    /* Construct the sorted order of type B suffixes by using
+       the sorted order of type B* suffixes. */
+    for(c1 = ALPHABET_SIZE - 2; 0 <= c1; --c1) {
+      /* Scan the suffix array from right to left. */
+      for(i = SA + BUCKET_BSTAR(c1, c1 + 1),
+          j = SA + BUCKET_A(c1 + 1) - 1, k = NULL, c2 = -1;
+          i <= j;
+          --j) {
+        if(0 < (s = *j)) {
+          assert(T[s] == c1);
+          assert(((s + 1) < n) && (T[s] <= T[s + 1]));
+          assert(T[s - 1] <= T[s]);
+          if((s % step) == 0) { samples[s / step] = j - SA; }
+          c0 = T[--s];
+          *j = ~((int)c0);
+          if((0 < s) && (T[s - 1] > c0)) { s = ~s; }
+          if(c0 != c2) {
+            if(0 <= c2) { BUCKET_B(c2, c1) = k - SA; }
+            k = SA + BUCKET_B(c2 = c0, c1);
+          }
+          assert(k < j);
+          *k-- = s;
+        } else if(s != 0) {
+          *j = ~s;
+#ifndef NDEBUG
+        } else {
+          assert(T[s] == c1);
+#endif
+        }
+      }
+    }
+  }
+
+  /* Construct the BWTed string by using
+     the sorted order of type B suffixes. */
+  k = SA + BUCKET_A(c2 = T[n - 1]);
+  if(T[n - 2] < c2) {
+    if(((n - 1) % step) == 0) { samples[(n - 1) / step] = k - SA; }
+    *k++ = ~((int)T[n - 2]);
+  } else {
+    *k++ = n - 1;
+  }
+  /* Scan the suffix array from left to right. */
+  for(i = SA, j = SA + n, orig = SA; i < j; ++i) {
+    if(0 < (s = *i)) {
+      assert(T[s - 1] >= T[s]);
+      if((s % step) == 0) { samples[s / step] = i - SA; }
+      c0 = T[--s];
+      *i = c0;
+      if(c0 != c2) {
+        BUCKET_A(c2) = k - SA;
+        k = SA + BUCKET_A(c2 = c0);
+      }
+      assert(i < k);
+      if((0 < s) && (T[s - 1] < c0)) {
+        /* Suffix s is never scanned again, its final position is k. */
+        if((s % step) == 0) { samples[s / step] = k - SA; }
+        s = ~((int)T[s - 1]);
+      }
+      *k++ = s;
+    } else if(s != 0) {
+      *i = ~s;
+    } else {
+      orig = i;
+    }
+  }
+  samples[0] = orig - SA;
+
+  return orig - SA;
+}
+
+
 /*---------------------------------------------------------------------------*/
 
+/* Threads used when the caller doesn't say, nested calls stay on their own thread. */
+static
+int
+default_threads(void) {
+#ifdef _OPENMP
+  return omp_in_parallel() ? 1 : omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
 /*- Function -*/
 
 int
 divsufsort(const unsigned char *T, int *SA, int n) {
+  return divsufsort_mt(T, SA, n, default_threads());
+}
+
+int
+divsufsort_mt(const unsigned char *T, int *SA, int n, int threads) {
   int *bucket_A, *bucket_B;
   int m;
   int err = 0;
@@ -1734,7 +1834,7 @@ divsufsort(const unsigned char *T, int *SA, int n) {
 
   /* Suffixsort. */
   if((bucket_A != NULL) && (bucket_B != NULL)) {
-    m = sort_typeBstar(T, SA, bucket_A, bucket_B, n);
+    m = sort_typeBstar(T, SA, bucket_A, bucket_B, n, (threads < 1) ? 1 : threads);
     construct_SA(T, SA, bucket_A, bucket_B, n, m);
   } else {
     err = -2;
@@ -1762,7 +1862,7 @@ divbwt(const unsigned char *T, unsigned char *U, int *A, int n) {
 
   /* Burrows-Wheeler Transform. */
   if((B != NULL) && (bucket_A != NULL) && (bucket_B != NULL)) {
-    m = sort_typeBstar(T, B, bucket_A, bucket_B, n);
+    m = sort_typeBstar(T, B, bucket_A, bucket_B, n, default_threads());
     pidx = construct_BWT(T, B, bucket_A, bucket_B, n, m);
 
     /* Copy to output string. */
@@ -1780,3 +1880,36 @@ divbwt(const unsigned char *T, unsigned char *U, int *A, int n) {
 
   return pidx;
 }
+
+int
+divbwt_sampled(const unsigned char *T, unsigned char *U, int *A, int n,
+               int step, int *samples, int threads) {
+  int *bucket_A, *bucket_B;
+  int m, pidx, i;
+
+  /* Check arguments. */
+  if((T == NULL) || (U == NULL) || (A == NULL) || (samples == NULL) || (step < 1) || (n < 0)) { return -1; }
+  else if(n <= 1) { if(n == 1) { U[0] = T[0]; samples[0] = 0; } return n; }
+
+  bucket_A = (int *)malloc(BUCKET_A_SIZE * sizeof(int));
+  bucket_B = (int *)malloc(BUCKET_B_SIZE * sizeof(int));
+
+  /* Burrows-Wheeler Transform. */
+  if((bucket_A != NULL) && (bucket_B != NULL)) {
+    m = sort_typeBstar(T, A, bucket_A, bucket_B, n, (threads < 1) ? 1 : threads);
+    pidx = construct_BWT_sampled(T, A, bucket_A, bucket_B, n, m, step, samples);
+
+    /* Copy to output string. */
+    U[0] = T[n - 1];
+    for(i = 0; i < pidx; ++i) { U[i + 1] = (unsigned char)A[i]; }
+    for(i += 1; i < n; ++i) { U[i] = (unsigned char)A[i]; }
+    pidx += 1;
+  } else {
+    pidx = -2;
+  }
+
+  free(bucket_B);
+  free(bucket_A);
+
+  return pidx;
+}
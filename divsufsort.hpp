@@ -44,6 +44,19 @@ extern "C" {
 int
 divsufsort(const unsigned char *T, int *SA, int n);
 
+/**
+ * Constructs the suffix array of a given string with a given amount of threads.
+ * The type B* buckets are sorted in parallel, this also works from within a parallel
+ * region as long as nested parallelism is enabled.
+ * @param T[0..n-1] The input string.
+ * @param SA[0..n-1] The output array of suffixes.
+ * @param n The length of the given string.
+ * @param threads The number of threads sorting buckets.
+ * @return 0 if no error occurred, -1 or -2 otherwise.
+ */
+int
+divsufsort_mt(const unsigned char *T, int *SA, int n, int threads);
+
 /**
  * Constructs the burrows-wheeler transformed string of a given string.
  * @param T[0..n-1] The input string.
@@ -55,6 +68,22 @@ divsufsort(const unsigned char *T, int *SA, int n);
 int
 divbwt(const unsigned char *T, unsigned char *U, int *A, int n);
 
+/**
+ * Constructs the burrows-wheeler transformed string of a given string,
+ * and records the suffix array position of every suffix which is a multiple of step.
+ * @param T[0..n-1] The input string.
+ * @param U[0..n-1] The output string. (can be T)
+ * @param A[0..n-1] The temporary array.
+ * @param n The length of the given string.
+ * @param step The distance between sampled suffixes.
+ * @param samples[0..(n-1)/step] The output suffix array positions, samples[0] is the primary index - 1.
+ * @param threads The number of threads sorting buckets.
+ * @return The primary index if no error occurred, -1 or -2 otherwise.
+ */
+int
+divbwt_sampled(const unsigned char *T, unsigned char *U, int *A, int n,
+               int step, int *samples, int threads);
+
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -18,6 +18,17 @@
 **********************************************/
 #include "filters.hpp"
 
+Filters::Filters(Arena *Scratch)
+{
+	Workspace = Scratch;
+	eCalc = new Utils;
+}
+
+Filters::~Filters()
+{
+	delete eCalc;
+}
+
 void Filters::DeltaEncode(unsigned char *in, int len)
 {
 	unsigned char previous = 0, cur = 0;
@@ -100,7 +111,7 @@ void Filters::Unreorder(unsigned char *in, unsigned char *out, int width, int le
 
 void Filters::InlineDelta(unsigned char *in, unsigned char *out, int width, int len)
 {
-	unsigned char *p = (unsigned char*)calloc(MAX_CHANNEL_WIDTH, sizeof(unsigned char));
+	unsigned char p[MAX_CHANNEL_WIDTH] = {0};
 
 	Index i = 0;
 	Index align = len % width;
@@ -116,12 +127,11 @@ void Filters::InlineDelta(unsigned char *in, unsigned char *out, int width, int
 		}
 		i += width;
 	}
-	free(p);
 }
 
 void Filters::InlineUndelta(unsigned char *in, unsigned char *out, int width, int len)
 {
-	unsigned char *p = (unsigned char*)calloc(MAX_CHANNEL_WIDTH, sizeof(unsigned char));
+	unsigned char p[MAX_CHANNEL_WIDTH] = {0};
 
 	
 	Index i = 0;
@@ -138,7 +148,6 @@ void Filters::InlineUndelta(unsigned char *in, unsigned char *out, int width, in
 		}
 		i += width;
 	}
-	free(p);
 }
 
 /**
@@ -148,7 +157,7 @@ int Filters::FindStride(unsigned char *in, int len)
 {
 	Index stride = 0;
 	Index dist[256] = {0};
-	Index *hist = (Index*)calloc((MAX_CHANNEL_WIDTH + 1), sizeof(Index));
+	Index hist[MAX_CHANNEL_WIDTH + 1] = {0};
 	unsigned char sym = 0;
 	for(int i = 0; i < len; i++)
 	{
@@ -173,7 +182,6 @@ int Filters::FindStride(unsigned char *in, int len)
 			smallest = j;
 		}
 	}
-	free(hist);
 	return smallest;
 }
 
@@ -186,7 +194,7 @@ int Filters::FindProjection(unsigned char *in, int len)
 	Index projection = 0;
 	Index dist0[256] = {0};
 	Index dist1[256] = {0};
-	Index *hist = (Index*)calloc((MAX_CHANNEL_WIDTH + 1), sizeof(Index));
+	Index hist[MAX_CHANNEL_WIDTH + 1] = {0};
 	unsigned char sym = 0;
 	for(int i = 0; i < len; i++)
 	{
@@ -213,27 +221,32 @@ int Filters::FindProjection(unsigned char *in, int len)
 			smallest = j;
 		}
 	}
-	free(hist);
 	return smallest;
 }
 
 /**
 * Structural modelling, detect deltas and fixed points within the input and encode it.
+* Returns JAM_OK, or JAM_ERROR_MEMORY if the prediction buffers can't be allocated.
 */
-void Filters::Encode(Buffer Input, Buffer Output, Options Opt)
+int Filters::Encode(Buffer Input, Buffer Output, Options Opt)
 {
 	if(Opt.Filters < 0)
 		Opt.Filters = 0;
 	if(Opt.Filters > 2)
 		Opt.Filters = 2;
 	
-	Utils *eCalc = new Utils;
-	double *eScores[3];	
-	eScores[0] = (double*)malloc(MAX_CHANNEL_WIDTH * sizeof(double)); // Standard delta
-	eScores[1] = (double*)malloc(MAX_CHANNEL_WIDTH * sizeof(double)); // Linear prediction
-	eScores[2] = (double*)malloc(MAX_CHANNEL_WIDTH * sizeof(double)); // Inline delta
-	if(eScores[0] == NULL || eScores[1] == NULL || eScores[2] == NULL)
-		Error("Failed to allocate filter prediction buffer!");
+	double eScores[MAX_SUPPORTED_CONFIGURATION][MAX_CHANNEL_WIDTH + 1]; // Standard delta, linear prediction, inline delta
+	
+	// Prediction buffers for every thread of the brute force search, the heuristic sections, and the final filter
+	size_t mark = Workspace->Mark();
+	const int Buffers = (Opt.Threads * 3 > 4) ? (Opt.Threads * 3) : 4;
+	unsigned char *pool = Workspace->Alloc<unsigned char>((size_t)FILTER_BLOCK_SIZE * Buffers);
+	unsigned char *buf = Workspace->Alloc<unsigned char>(FILTER_BLOCK_SIZE);
+	if(pool == NULL || buf == NULL)
+	{
+		Workspace->Release(mark);
+		return JAM_ERROR_MEMORY;
+	}
 	
 	// Read all of the input
 	Index Outp = 0;
@@ -259,11 +272,9 @@ void Filters::Encode(Buffer Input, Buffer Output, Options Opt)
 			#pragma omp parallel for num_threads(Opt.Threads)
 			for(int Ch = 0; Ch <= MAX_CHANNEL_WIDTH; Ch++)
 			{
-				unsigned char *dbuf = (unsigned char*)malloc(FILTER_BLOCK_SIZE * sizeof(unsigned char));
-				unsigned char *lbuf = (unsigned char*)malloc(FILTER_BLOCK_SIZE * sizeof(unsigned char));
-				unsigned char *ibuf = (unsigned char*)malloc(FILTER_BLOCK_SIZE * sizeof(unsigned char));
-				if(dbuf == NULL || lbuf == NULL || ibuf == NULL)
-					Error("Failed to allocate filter prediction buffers!");
+				unsigned char *dbuf = &pool[(size_t)FILTER_BLOCK_SIZE * (omp_get_thread_num() * 3)];
+				unsigned char *lbuf = &dbuf[FILTER_BLOCK_SIZE];
+				unsigned char *ibuf = &lbuf[FILTER_BLOCK_SIZE];
 				if(Ch > 0)
 				{
 					Reorder(&Input.block[i], dbuf, Ch, boostread);
@@ -279,9 +290,6 @@ void Filters::Encode(Buffer Input, Buffer Output, Options Opt)
 				{
 					eScores[0][Ch] = eCalc->CalculateMixedEntropy(&Input.block[i], boostread);
 				}
-				free(dbuf);
-				free(lbuf);
-				free(ibuf);
 			}
 		}
 		if(Opt.Filters == 1)
@@ -297,9 +305,7 @@ void Filters::Encode(Buffer Input, Buffer Output, Options Opt)
 				// Compute delta entropy
 				#pragma omp section
 				{
-				   	unsigned char *dbuf = (unsigned char*)malloc(FILTER_BLOCK_SIZE * sizeof(unsigned char));
-					if(dbuf == NULL)
-						Error("Failed to allocate filter prediction buffer!");
+				   	unsigned char *dbuf = &pool[FILTER_BLOCK_SIZE * 0];
 					int Ch = FindStride(&Input.block[i], len);
 					if(Ch > 0)
 					{
@@ -307,14 +313,11 @@ void Filters::Encode(Buffer Input, Buffer Output, Options Opt)
 						DeltaEncode(dbuf, boostread);
 						eScores[0][Ch] = eCalc->CalculateSortedEntropy(dbuf, boostread);
 					}
-					free(dbuf);
 				}
 				// Compute linear prediction entropy
 				#pragma omp section
 				{
-					unsigned char *lbuf = (unsigned char*)malloc(FILTER_BLOCK_SIZE * sizeof(unsigned char));
-					if(lbuf == NULL)
-						Error("Failed to allocate filter prediction buffer!");
+					unsigned char *lbuf = &pool[FILTER_BLOCK_SIZE * 1];
 					int Ch = FindProjection(&Input.block[i], len);
 					if(Ch > 0)
 					{
@@ -322,31 +325,25 @@ void Filters::Encode(Buffer Input, Buffer Output, Options Opt)
 						LpcEncode(lbuf, boostread);
 						eScores[1][Ch] = eCalc->CalculateSortedEntropy(lbuf, boostread);
 					}
-					free(lbuf);
 				}
 				
 				// Compute inline delta entropy
 				#pragma omp section
 				{
-					unsigned char *ibuf = (unsigned char*)malloc(FILTER_BLOCK_SIZE * sizeof(unsigned char));
-					if(ibuf == NULL)
-						Error("Failed to allocate filter prediction buffer!");
+					unsigned char *ibuf = &pool[FILTER_BLOCK_SIZE * 2];
 					int Ch = FindStride(&Input.block[i], len);
 					if(Ch > 0)
 					{
 						InlineDelta(&Input.block[i], ibuf, Ch, boostread);
 						eScores[2][Ch] = eCalc->CalculateSortedEntropy(ibuf, boostread);
 					}
-					free(ibuf);
 				}
 				
 				// Compute entropy of previous block configuration on current block
 				// Due to the previous state not being taken into account by other threads this can cause scheduling issues when writing the entropy score if it collides with another, 'pconfig' fixes that.
 				#pragma omp section
 				{
-					unsigned char *pbuf = (unsigned char*)malloc(FILTER_BLOCK_SIZE * sizeof(unsigned char));
-					if(pbuf == NULL)
-						Error("Failed to allocate filter prediction buffer!");
+					unsigned char *pbuf = &pool[FILTER_BLOCK_SIZE * 3];
 					
 					if(PrevWidth > 0)
 					{
@@ -361,7 +358,6 @@ void Filters::Encode(Buffer Input, Buffer Output, Options Opt)
 						DeltaEncode(pbuf, boostread);
 					}
 					pconfig = eCalc->CalculateSortedEntropy(pbuf, boostread);
-					free(pbuf);
 				}
 			}
 			if(eScores[PrevType][PrevWidth] == 8.0f)
@@ -386,10 +382,6 @@ void Filters::Encode(Buffer Input, Buffer Output, Options Opt)
 		}
 		//printf("Using filter %i with a width of %i has entropy %.2f\n", type, smallest, min);
 		
-		unsigned char *buf = (unsigned char*)malloc(FILTER_BLOCK_SIZE * sizeof(unsigned char));
-		if(buf == NULL)
-				Error("Failed to allocate filter prediction buffer!");
-			
 		if(type >= MAX_SUPPORTED_CONFIGURATION || smallest > MAX_CHANNEL_WIDTH)
 			Error("Filter is trying to encode from an unsupported configuration!");
 			
@@ -425,25 +417,29 @@ void Filters::Encode(Buffer Input, Buffer Output, Options Opt)
 			memcpy(&Output.block[Outp], &Input.block[i], len * sizeof(unsigned char));
 			RawBlocks++;
 		}
-		free(buf);
 		PrevType = type;
 		PrevWidth = smallest;
 		Outp += len;
 		i += len;
 	}
 	//printf("\ndelta blocks: %i, raw blocks: %i\n", DeltaBlocks, RawBlocks);
-	delete eCalc;
-	free(eScores[0]);
-	free(eScores[1]);
-	free(eScores[2]);
+	Workspace->Release(mark);
 	*Output.size = Outp;
+	return JAM_OK;
 }
 
-void Filters::Decode(Buffer Input, Buffer Output)
+/**
+* Returns JAM_OK, JAM_ERROR_CORRUPT on a configuration the encoder never writes, or JAM_ERROR_MEMORY
+*/
+int Filters::Decode(Buffer Input, Buffer Output)
 {
-	unsigned char *dbuf = (unsigned char*)malloc(FILTER_BLOCK_SIZE * sizeof(unsigned char));
+	size_t mark = Workspace->Mark();
+	unsigned char *dbuf = Workspace->Alloc<unsigned char>(FILTER_BLOCK_SIZE);
 	if(dbuf == NULL)
-		Error("Failed to allocate filter prediction buffer!");
+	{
+		Workspace->Release(mark);
+		return JAM_ERROR_MEMORY;
+	}
 	
 	Index Outp = 0;
 	for(Index i = 0; i < *Input.size;)
@@ -451,8 +447,11 @@ void Filters::Decode(Buffer Input, Buffer Output)
 		unsigned char type = Input.block[i++];
 		unsigned char channel = Input.block[i++];
 
-		if(type >= MAX_SUPPORTED_CONFIGURATION || channel > MAX_CHANNEL_WIDTH)
-			Error("Filter is trying to decode from unsupported configuration!");
+		if(type >= MAX_SUPPORTED_CONFIGURATION || channel > MAX_CHANNEL_WIDTH) // Filter is trying to decode from unsupported configuration
+		{
+			Workspace->Release(mark);
+			return JAM_ERROR_CORRUPT;
+		}
 		
 		int len = ((i + FILTER_BLOCK_SIZE) < *Input.size) ? FILTER_BLOCK_SIZE : (*Input.size - i);
 		if(channel > 0)
@@ -485,6 +484,7 @@ void Filters::Decode(Buffer Input, Buffer Output)
 		i += len;
 	}
 	
-	free(dbuf);
+	Workspace->Release(mark);
 	*Output.size = Outp;
+	return JAM_OK;
 }
@@ -21,13 +21,17 @@
 
 #include "format.hpp"
 #include "utils.hpp"
+#include "arena.hpp"
 
 class Filters
 {
 private:
-	const int MAX_SUPPORTED_CONFIGURATION = 3; // Ammount of configurations not including channels (3 because, delta, lpc, and inline delta)
-	const int MAX_CHANNEL_WIDTH = 32; // 0 to 32
-	const int FILTER_BLOCK_SIZE = 64 << 10;
+	static const int MAX_SUPPORTED_CONFIGURATION = 3; // Ammount of configurations not including channels (3 because, delta, lpc, and inline delta)
+	static const int MAX_CHANNEL_WIDTH = 32; // 0 to 32
+	static const int FILTER_BLOCK_SIZE = 64 << 10;
+	
+	Arena *Workspace; // Prediction buffers are borrowed from the instance arena
+	Utils *eCalc;
 	
 	void DeltaEncode(unsigned char *in, int len);
 	void DeltaDecode(unsigned char *in, int len);
@@ -41,7 +45,9 @@ private:
 	int FindStride(unsigned char *in, int len);
 	int FindProjection(unsigned char *in, int len);
 public:
-	void Encode(Buffer Input, Buffer Output, Options Opt);
-	void Decode(Buffer Input, Buffer Output);
+	Filters(Arena *Scratch);
+	~Filters();
+	int Encode(Buffer Input, Buffer Output, Options Opt);	// JAM_OK or JAM_ERROR_MEMORY
+	int Decode(Buffer Input, Buffer Output);	// JAM_OK, JAM_ERROR_CORRUPT, or JAM_ERROR_MEMORY
 };
 #endif // FILTERS_H
@@ -16,18 +16,60 @@
 #include <omp.h>
 #include "sys_detect.hpp"
 
-#define JAM_VERSION		0.80
+#define JAM_VERSION		0.81
 #define DEFAULT_BLOCKSIZE 	8 << 20
 #define MIN_BLOCKSIZE 		1 << 20
 #define MAX_BLOCKSIZE 		1000 << 20
 #define MAX_THREADS		GetCoreCount()
 #define MIN_THREADS		1
 #define DEFAULT_THREADS 	((GetCoreCount() == 1) ? 1 : GetCoreCount() - 1)
-#define BWT_UNITS 		120	// The amount of independant parallel units that can process the BWT block
+#define BLOCK_FORMAT		1	// Layout of the blocks written: 0 is the 0.80 layout (BWT tail of BWT_LEGACY_UNITS indices only), 1 adds the unit count and transform byte to the tail
+#define BLOCK_FORMAT_SHIFT	30	// The format is kept above the block size in the block header (MAX_BLOCKSIZE needs the 30 bits below), so 0.80 headers read as format 0
+#define BWT_LEGACY_UNITS	120	// Sampled indices of every format 0 block
+#define BWT_MIN_UNITS 		256	// Fewest sampled indices of a BWT block (independent decoding chains)
+#define BWT_MAX_UNITS 		8192	// Most sampled indices of a BWT block
+#define BWT_UNIT_SHIFT 		13	// One sampled index per 8 KB of block in between
+#define BWT_TAIL(Units)		((Units) * sizeof(Index) + sizeof(Index) + 1)	// Sampled indices, their count, and the transform byte
+#define ST_MIN_ORDER		3	// Shortest context of the limited context sort
+#define ST_MAX_ORDER		8	// Longest context of the limited context sort
+#define ST_MIN_SEGMENT		(4 << 20)	// Smallest independently sorted segment of the limited context sort (smaller segments split contexts too much)
 #define MAX_GPU_RESOURCES	0.80	// Use up to 80% of GPU memory
+#define PAIR_MAX_ENTROPY	6.0	// Blocks below this order-0 entropy (bits per symbol) are inverted two symbols per step
+#define MAX_MEMORY_USAGE	0.75	// Decoders fall back to the low memory inverse bwt when the full map would take more than 75% of physical memory
+#define RANK_BLOCK_SHIFT	10	// The low memory inverse bwt keeps 16-bit symbol counts every 1 KB of block, 
+#define RANK_SUPER_SHIFT	16	// relative to 32-bit counts every 64 KB
+#define PIPELINE_DEPTH		2	// Spare block instances the reader may fill ahead of the workers
+#define HUGE_PAGE_SIZE		(2 << 20)	// Alignment and granularity of the workspace arena chunks with huge pages
+#define ARENA_SLACK		(32 << 20)	// Workspace on top of the suffix array for entropy coding, filter, and match finder buffers
+
+// Vector kernels are compiled for their own instruction set and only called after runtime detection (see GetSimdLevel)
+#if defined(__GNUC__)
+	#define TARGET_SSE41 	__attribute__((target("sse4.1")))
+	#define TARGET_AVX2 	__attribute__((target("avx2")))
+#else
+	#define TARGET_SSE41
+	#define TARGET_AVX2
+#endif
+
+// SSE2 kernels which aren't worth a runtime dispatch are compiled in whenever the target has SSE2 (every x86-64, not x86-32 without -msse2), 
+// they keep a scalar path for the other targets
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define HAVE_SSE2
+#endif
+
+// Status of the decode path, stages and header parsing report failures with these so a library caller is never exited (mirrored in libjampack.hpp)
+#define JAM_OK			0
+#define JAM_ERROR_CORRUPT	-2	// Truncated or corrupt compressed data (-1 is left to the library for a too small destination)
+#define JAM_ERROR_MEMORY	-3	// An allocation failed
+#define JAM_ERROR_VERSION	-4	// The block has a format newer than BLOCK_FORMAT
+
+enum SlotState { SLOT_FREE, SLOT_BUSY, SLOT_DONE }; // Life cycle of a block instance inside the de/compression pipeline
 
 static const char Magic[]="JAM";
 static const char MagicLength = 3;
+static const char IndexMagic[]="JIX"; // Marks the optional block index trailer at the end of an archive
+
+#define BLOCK_HEADER_SIZE	(MagicLength + 2 * sizeof(int) + sizeof(Index)) // Magic, crc, compressed size, and block size (with the block format above it)
 
 typedef int Index;
 
@@ -38,6 +80,7 @@ struct Buffer
 {
 	unsigned char *block;
 	Index *size;
+	Index capacity; // Bytes allocated for block, a decoder never writes past it
 };
 
 /**
@@ -48,9 +91,30 @@ struct Options
 	Index BlockSize; // Size of the block to compress
 	unsigned int MatchFinder; // 8 = Suffix array match finding, 1 to 7 is hash chain with memory reduction by 1/n+1, 0 is fast dedupe 
 	unsigned int Threads; // Pretty self explanatory 
+	unsigned int SortThreads; // Threads a single block may use to build its suffix array and code its entropy chunks, the pipeline hands idle cores to the blocks in flight
 	unsigned int Filters; // Brute force filter configurations instead of distance histogram detection (tries 96+1 filter configurations and picks the best)
 	bool Gpu; // Use gpu acceleration if available 
 	bool Multiblock; // Use multiple block threading if true, if false then it uses multiple threads working on a single block.
+	unsigned int Numa; // 0 = let the os place workers and memory, 1 = pin workers round robin to NUMA nodes and keep every block instance on the node of its worker
+	bool HugePages; // Back the workspace arenas (suffix arrays, inverse maps, match finder tables) with 2 MB aligned huge pages
+	bool LowMemory; // Invert the bwt with sampled rank tables (about 2.5N to decode) instead of the full map (6N), also chosen automatically when 6N doesn't fit
+	unsigned int EntropyMode; // 0 = four interleaved byte-wise rANS states, 1 = eight word-wise rANS lanes decoded with SIMD, 2 = static tANS tables (fastest decode, lower ratio)
+	unsigned int SortOrder; // 0 = full Burrows Wheeler transform, 3 to 8 = limited context sort over that many symbols (linear time, slightly weaker)
+	bool BlockIndex; // Append a block index to the archive so ranges can be decoded without decoding everything before them
+	uint64_t RangeStart; // First uncompressed byte to extract when range decoding
+	uint64_t RangeLength; // Amount of uncompressed bytes to extract, 0 decodes the whole archive
+	unsigned int BlockFormat; // Layout of the block being decoded, taken from its header (see BLOCK_FORMAT)
+};
+
+/**
+* One entry of the block index trailer, the trailer is laid out as:
+* IndexMagic, block count (32-bit), entries, total uncompressed size (64-bit), trailer size (64-bit), IndexMagic.
+*/
+struct BlockEntry
+{
+	uint64_t RawOffset; // Offset of the block in the uncompressed stream
+	uint64_t CompOffset; // Offset of the block header in the archive
+	unsigned int Crc; // Checksum of the uncompressed block
 };
 
 /**
@@ -25,47 +25,85 @@ void Jampack::SwapStreams()
 }
 
 /**
-* Compress a block using all compression stages.
+* Compress a block using all compression stages, returns JAM_OK or JAM_ERROR_MEMORY if a stage couldn't get its workspace.
 */
-void Jampack::Comp()
+int Jampack::Comp()
 {
 	crc = Chk->IntegrityCheck(Input);
 	
+	int Status;
 	Options Dedupe = Option;
 	Dedupe.MatchFinder = 0; // Set to 0 for deduplication
-	Lz->Compress		(Input, Output, Dedupe);	SwapStreams(); 	// Deduplicate big chunks (limited to block size)
-	Filter->Encode		(Input, Output, Option); 	SwapStreams(); 	// Filter any fixed points or linear projections (image, audio, triangular meshes, pretty much anything with a structure)
-	LocalModel->Encode	(Input, Output, Option); 	SwapStreams();	// Local prefix model (short localized match induction)
-	Lz->Compress		(Input, Output, Option);	SwapStreams(); 	// Compress data bwt cannot see (i.e: anti-contexts: sparse contexts, positional context, basically any non-markovian contexts)
-	Bwt->ForwardBwt		(Input, Output); 		SwapStreams(); 	// Burrows wheeler transform
-	Entropy->Encode		(Input, Output, Option);	// Structured rANS with large alphabet models
+	if((Status = Lz->Compress(Input, Output, Dedupe)) != JAM_OK) return Status;	// Deduplicate big chunks (limited to block size)
+	SwapStreams();
+	if((Status = Filter->Encode(Input, Output, Option)) != JAM_OK) return Status;	// Filter any fixed points or linear projections (image, audio, triangular meshes, pretty much anything with a structure)
+	SwapStreams();
+	LocalModel->Encode(Input, Output, Option);					// Local prefix model (short localized match induction)
+	SwapStreams();
+	if((Status = Lz->Compress(Input, Output, Option)) != JAM_OK) return Status;	// Compress data bwt cannot see (i.e: anti-contexts: sparse contexts, positional context, basically any non-markovian contexts)
+	SwapStreams();
+	if((Status = Bwt->ForwardBwt(Input, Output, Option)) != JAM_OK) return Status;	// Burrows wheeler transform
+	SwapStreams();
+	return Entropy->Encode(Input, Output, Option);					// Structured rANS with large alphabet models
 }
 
 /**
-* Decompress a block using inverse stages.
+* Decompress a block using inverse stages, returns JAM_OK or the status of the first stage that failed.
 */
-void Jampack::Decomp()
+int Jampack::Decomp()
 {
-	Entropy->Decode		(Input, Output, Option);	SwapStreams(); 	// Good!
-	Bwt->InverseBwt		(Input, Output, Option);	SwapStreams(); 	// Well... Try to add 2N decoding
-	Lz->Decompress		(Input, Output);		SwapStreams();	// Good!
-	LocalModel->Decode	(Input, Output, Option);	SwapStreams(); 	// Good!
-	Filter->Decode		(Input, Output);		SwapStreams();	// Good!	
-	Lz->Decompress		(Input, Output);
+	int Status;
+	if((Status = Entropy->Decode(Input, Output, Option)) != JAM_OK) return Status;	// Good!
+	SwapStreams();
+	if((Status = Bwt->InverseBwt(Input, Output, Option)) != JAM_OK) return Status;	// Good! (2.5N with sampled rank tables when 6N doesn't fit)
+	SwapStreams();
+	if((Status = Lz->Decompress(Input, Output)) != JAM_OK) return Status;		// Good!
+	SwapStreams();
+	LocalModel->Decode(Input, Output, Option);					// Good!
+	SwapStreams();
+	if((Status = Filter->Decode(Input, Output)) != JAM_OK) return Status;		// Good!
+	SwapStreams();
+	if((Status = Lz->Decompress(Input, Output)) != JAM_OK) return Status;
 	
-	if(crc != Chk->IntegrityCheck(Output)) 
-		Error("Detected corrupt block!"); 
+	if(crc != Chk->IntegrityCheck(Output)) // Detected corrupt block
+		return JAM_ERROR_CORRUPT; 
+	return JAM_OK;
 }
 
-void Jampack::InitComp(Options Opt)
+/**
+* The command-line tool stops on the first failure, the library hands the status to its caller instead
+*/
+static void CheckStatus(int Status)
+{
+	if(Status == JAM_ERROR_CORRUPT)
+		Error("Detected corrupt block!");
+	if(Status == JAM_ERROR_MEMORY)
+		Error("Couldn't allocate Buffers!");
+	if(Status == JAM_ERROR_VERSION)
+		Error("Block format is newer than this version supports!");
+}
+
+/**
+* Every stage of an instance borrows its scratch memory from the same arena, stages run one after another so they share the space.
+*/
+void Jampack::CreateStages(Options Opt)
 {
 	Option = Opt;
-	Entropy = 	new Ans();
-	Bwt = 		new BlockSort::Bwt();
-	Lz = 		new Lz77();
+	Scratch = 	new Arena(Opt.HugePages);
+	Entropy = 	new Ans(Scratch);
+	Bwt = 		new BlockSort::Bwt(Scratch);
+	Lz = 		new Lz77(Scratch);
 	Chk = 		new Checksum();
-	Filter = 	new Filters();
+	Filter = 	new Filters(Scratch);
 	LocalModel = 	new Lpx();
+}
+
+/**
+* Returns JAM_OK, or JAM_ERROR_MEMORY if the buffers or the workspace can't be allocated
+*/
+int Jampack::InitComp(Options Opt)
+{
+	CreateStages(Opt);
 		
 	if(Opt.BlockSize < 0 || Opt.BlockSize < MIN_BLOCKSIZE || Opt.BlockSize > MAX_BLOCKSIZE) 
 		Error("Invalid blocksize!"); 
@@ -74,27 +112,27 @@ void Jampack::InitComp(Options Opt)
 	int Buf = (int)(BlockSize) * 1.05;
 	Input.block = (unsigned char*)calloc(Buf, sizeof(unsigned char));
 	Output.block = (unsigned char*)calloc(Buf, sizeof(unsigned char));	
-	
-	if (Input.block == NULL || Output.block == NULL) 
-		Error("Couldn't allocate Buffers!");
+	Input.capacity = Output.capacity = Buf;
 	
 	Input.size = (int*)calloc(1, sizeof(int));
 	Output.size = (int*)calloc(1, sizeof(int));
+	if (Input.block == NULL || Output.block == NULL || Input.size == NULL || Output.size == NULL) 
+		return JAM_ERROR_MEMORY;
+	
+	// The suffix arrays of the bwt or the -m2 match finder are the largest users (the limited context sort needs two row arrays), the rest fits in the slack
+	if(!Scratch->Reserve((size_t)Buf * sizeof(Index) * ((Opt.MatchFinder == 2 || Opt.SortOrder != 0) ? 2 : 1) + ARENA_SLACK))
+		return JAM_ERROR_MEMORY;
+	return JAM_OK;
 }
 
 void Jampack::InitDecomp(Options Opt)
 {
-	Option = Opt;
-	Entropy = 	new Ans();
-	Bwt = 		new BlockSort::Bwt();
-	Lz = 		new Lz77();
-	Chk = 		new Checksum();
-	Filter = 	new Filters();
-	LocalModel = 	new Lpx();
+	CreateStages(Opt);
 	Input.size = (int*)calloc(1, sizeof(int));
 	Output.size = (int*)calloc(1, sizeof(int));
 	Input.block = (unsigned char*)malloc(sizeof(unsigned char));
 	Output.block = (unsigned char*)malloc(sizeof(unsigned char));	
+	Input.capacity = Output.capacity = 1;
 }
 
 void Jampack::Free()
@@ -105,6 +143,7 @@ void Jampack::Free()
 	delete Lz;
 	delete Chk;
 	delete LocalModel;
+	delete Scratch;
 	free(Output.block);
 	free(Input.block);
 	free(Input.size);
@@ -117,50 +156,140 @@ int Jampack::CompReadBlock(FILE *in)
 }
 	
 /**
-* Write header and compressed block
+* Serialize the block header (magic, crc, compressed size, block size and format), returns the header length
 */
-void Jampack::CompWriteBlock(FILE *out)
+int Jampack::WriteBlockHeader(unsigned char *header)
 {
-	unsigned char *header = (unsigned char*)malloc((8 << 10) * sizeof(unsigned char));
-	if(header == NULL)
-		Error("Failed to allocate header space!");
+	uint32_t Size = (uint32_t)BlockSize | ((uint32_t)BLOCK_FORMAT << BLOCK_FORMAT_SHIFT);
+	int pos = 0;
+	memcpy(&header[pos], &Magic, strlen(Magic));		pos += strlen(Magic);
+	memcpy(&header[pos], &crc, sizeof(int));		pos += sizeof(int);
+	memcpy(&header[pos], Output.size, sizeof(int));		pos += sizeof(int);
+	memcpy(&header[pos], &Size, sizeof(uint32_t));		pos += sizeof(uint32_t);
+	return pos;
+}
+
+/**
+* Check a block header without touching the instance, returns JAM_OK, JAM_ERROR_CORRUPT, or JAM_ERROR_VERSION.
+* Streaming callers run this as soon as the header is in, before they wait for a payload of the size it claims.
+*/
+int Jampack::CheckBlockHeader(const unsigned char *header)
+{
+	int size;
+	uint32_t Size;
+	memcpy(&size, &header[MagicLength + sizeof(int)], sizeof(int));
+	memcpy(&Size, &header[MagicLength + 2 * sizeof(int)], sizeof(uint32_t));
+	int Block = Size & ((1u << BLOCK_FORMAT_SHIFT) - 1);
+	int Buf = (int)(Block) * 1.05;
+	if (Block < MIN_BLOCKSIZE || Block > MAX_BLOCKSIZE || memcmp(header, Magic, strlen(Magic)) != 0 || size < 0 || size > Buf)
+		return JAM_ERROR_CORRUPT;
+	if ((int)(Size >> BLOCK_FORMAT_SHIFT) > BLOCK_FORMAT) // Rejected here, the stages only know the formats up to BLOCK_FORMAT
+		return JAM_ERROR_VERSION;
+	return JAM_OK;
+}
+
+/**
+* Validate a block header and size the decoder buffers for it, returns JAM_OK, JAM_ERROR_CORRUPT, JAM_ERROR_VERSION, or JAM_ERROR_MEMORY
+*/
+int Jampack::ReadBlockHeader(const unsigned char *header)
+{
+	int Status = CheckBlockHeader(header);
+	if(Status != JAM_OK)
+		return Status;
 	
-	fwrite(&Magic, 1, strlen(Magic), out);
-	fwrite(&crc, 1, sizeof(int), out);
-	fwrite(Output.size, 1, sizeof(int), out);
-	fwrite(&BlockSize, 1, sizeof(Index), out);
-	fwrite(Output.block, 1, *Output.size, out); 
+	uint32_t Size = 0;
+	int pos = strlen(Magic);
+	memcpy(&crc, &header[pos], sizeof(int));		pos += sizeof(int);
+	memcpy(Input.size, &header[pos], sizeof(int));		pos += sizeof(int);
+	memcpy(&Size, &header[pos], sizeof(uint32_t));		pos += sizeof(uint32_t);
+	BlockSize = Size & ((1u << BLOCK_FORMAT_SHIFT) - 1);
+	Option.BlockFormat = Size >> BLOCK_FORMAT_SHIFT;
 	
-	free(header);
+	int Buf = (int)(BlockSize) * 1.05;
+	unsigned char *In = (unsigned char*)realloc(Input.block, Buf * sizeof(unsigned char));
+	if (In == NULL) 
+		return JAM_ERROR_MEMORY;
+	Input.block = In;
+	Input.capacity = Buf;
+	unsigned char *Out = (unsigned char*)realloc(Output.block, Buf * sizeof(unsigned char));	
+	if (Out == NULL) 
+		return JAM_ERROR_MEMORY;
+	Output.block = Out;
+	Output.capacity = Buf;
+	if(!Scratch->Reserve(BlockSort::Bwt::InverseMemory(Buf, Option) + ARENA_SLACK)) // Packed map or sampled rank tables of the inverse bwt, does nothing once it's big enough
+		return JAM_ERROR_MEMORY;
+	return JAM_OK;
+}
+
+/**
+* Write header and compressed block
+*/
+uint64_t Jampack::CompWriteBlock(FILE *out)
+{
+	unsigned char header[BLOCK_HEADER_SIZE];
+	int len = WriteBlockHeader(header);
+	fwrite(header, 1, len, out);
+	fwrite(Output.block, 1, *Output.size, out); 
+	return len + *Output.size;
+}
+
+/**
+* Write header and compressed block to memory, the caller makes sure there is room for BLOCK_HEADER_SIZE + *Output.size bytes
+*/
+uint64_t Jampack::CompWriteBlock(unsigned char *out)
+{
+	int len = WriteBlockHeader(out);
+	memcpy(&out[len], Output.block, *Output.size);
+	return len + *Output.size;
 }
 
 /**
-* Read header and compressed block
+* Read header and compressed block.
+* Returns the size of the block, 0 if there are no more blocks, or a negative status if the block is truncated or its header is corrupt.
 */	
 int Jampack::DecompReadBlock(FILE *in)
 {
-	char Magic_check[MagicLength+1] = {0};
-	fread(&Magic_check, 1, strlen(Magic), in);
-	fread(&crc, 1, sizeof(int), in);
-	fread(Input.size, 1, sizeof(int), in);
-	int e = fread(&BlockSize, 1, sizeof(Index), in);
-	if (e == 0 ) return 0;
-	else 
-	{
-		if (BlockSize < MIN_BLOCKSIZE || BlockSize > MAX_BLOCKSIZE || strcmp(Magic_check, Magic) != 0 || *Input.size < 0 || *Input.size > MAX_BLOCKSIZE)
-		{
-			Error("Refusing to read from corrupt header!");
-			return 0;
-		} 
-		else
-		{
-			int Buf = (int)(BlockSize) * 1.05;
-			Input.block = (unsigned char*)realloc(Input.block, Buf * sizeof(unsigned char));
-			Output.block = (unsigned char*)realloc(Output.block, Buf * sizeof(unsigned char));	
-			if (Input.block == NULL || Output.block == NULL) Error("Couldn't allocate Buffers!");
-			return fread(Input.block, 1, *Input.size, in);
-		}
-	}
+	unsigned char header[BLOCK_HEADER_SIZE];
+	int e = fread(header, 1, BLOCK_HEADER_SIZE, in);
+	if(e >= MagicLength && memcmp(header, IndexMagic, strlen(IndexMagic)) == 0) // Reached the block index trailer, there are no more blocks
+		return 0;
+	if(e == 0)
+		return 0;
+	if(e != BLOCK_HEADER_SIZE)
+		return JAM_ERROR_CORRUPT;
+	
+	int Status = ReadBlockHeader(header);
+	if(Status != JAM_OK)
+		return Status;
+	if((int)fread(Input.block, 1, *Input.size, in) != *Input.size)
+		return JAM_ERROR_CORRUPT;
+	return *Input.size;
+}
+
+/**
+* Read header and compressed block from memory. 
+* Returns the bytes consumed, 0 if the block isn't complete yet, -1 if there are no more blocks, or a status below that if the header is corrupt.
+*/
+int64_t Jampack::DecompReadBlock(const unsigned char *in, uint64_t len)
+{
+	if(len >= (uint64_t)MagicLength && memcmp(in, IndexMagic, strlen(IndexMagic)) == 0)
+		return -1;
+	if(len < BLOCK_HEADER_SIZE)
+		return 0;
+	
+	int Status = CheckBlockHeader(in); // A corrupt header is reported now instead of waiting for a payload which never comes
+	if(Status != JAM_OK)
+		return Status;
+	int size;
+	memcpy(&size, &in[MagicLength + sizeof(int)], sizeof(int));
+	if(len < BLOCK_HEADER_SIZE + (uint64_t)size)
+		return 0;
+	
+	Status = ReadBlockHeader(in);
+	if(Status != JAM_OK)
+		return Status;
+	memcpy(Input.block, &in[BLOCK_HEADER_SIZE], *Input.size);
+	return BLOCK_HEADER_SIZE + *Input.size;
 }
 
 /**
@@ -180,59 +309,246 @@ void Jampack::DisplayHeaderContents()
 }
 
 /**
-*	This handles the IO and compressor instances shared among parallel threads. 
-*	Multi-threading is written as multiple instances of the compressor running in parallel.
+*	This handles the IO and codec instances shared among parallel threads. 
+*	Multi-threading is written as a pipeline over a ring of instances, every thread takes turns being the reader, 
+*	processes the block it read, then hands it to the ordered writer. Nobody waits on the rest of a batch, 
+*	a thread only stalls when every instance in the ring is waiting behind the oldest unwritten block.
 */
-void Jampack::Compress(FILE *in, FILE *out, Options Opt)
+void Jampack::Pipeline(FILE *in, FILE *out, Options Opt, bool Decode)
 {
-	if(Opt.Threads < MIN_THREADS) Opt.Threads = MIN_THREADS;
-	if(Opt.Threads > MAX_THREADS) Opt.Threads = MAX_THREADS;
-	if(Opt.BlockSize < MIN_BLOCKSIZE) Opt.BlockSize = MIN_BLOCKSIZE;
-	if(Opt.BlockSize > MAX_BLOCKSIZE) Opt.BlockSize = MAX_BLOCKSIZE;
-	
-	Jampack *jam = new Jampack[Opt.Threads];  
+	const int Slots = Opt.Threads + PIPELINE_DEPTH; // A few spare instances let the reader run ahead of a slow block
+	Jampack *jam = new Jampack[Slots];  
 	if(jam == NULL) 
-		Error("Couldn't allocate compressor!");
+		Error("Couldn't allocate block instances!");
+	
+	// With NUMA placement every worker is pinned to a node and every instance belongs to the node of the worker which initialized it,
+	// workers only claim instances of their own node so the buffers and the arena are first touched and used on one node.
+	const int Nodes = (Opt.Numa != 0) ? GetNumaNodes() : 1;
+	int *SlotNode = new int[Slots];
 	
-	for(int n = 0; n < (int)Opt.Threads; n++) 
-		jam[n].InitComp(Opt);
+	int *State = new int[Slots];
+	uint64_t *Sequence = new uint64_t[Slots];
+	Index *ReadSize = new Index[Slots];
+	for(int n = 0; n < Slots; n++)
+		State[n] = SLOT_FREE;
+	
+	uint64_t NextRead = 0, NextWrite = 0;
+	bool Eof = false;
+	int Active = 0; // Blocks being compressed right now
+	uint64_t Freed = 0; // Slots handed back by the writer so far, a worker without a slot sleeps until it moves
+	
+	// Fewer workers than cores (big blocks are limited by memory) or a tail of the last few blocks leaves cores idle, 
+	// those are handed to the suffix sorts of the blocks in flight through nested parallelism.
+	// The nesting level is process wide, the caller's setting is restored once the pipeline is done.
+	const int Cores = MAX_THREADS;
+	const int Levels = omp_get_max_active_levels();
+	if(!Decode && Cores > 1)
+		omp_set_max_active_levels(2);
+	
+	BlockEntry *Entries = NULL; // Block index, only gathered when compressing with Opt.BlockIndex
+	unsigned int EntryCount = 0, EntryCapacity = 0;
+	uint64_t Written = 0;
 	
 	uint64_t raw = 0, comp = 0;
 	double ratio = 0;
 	time_t start, cur;
 	start = clock();
 	
-	while(1)
+	#pragma omp parallel num_threads(Opt.Threads)
 	{
-		if(feof(in)) break;
-		int s = 0;
-		while(!feof(in) && (s < (int)Opt.Threads))
-		{
-			jam[s].CompReadBlock(in);
-			raw += *jam[s].Input.size;
-			s++;
-		}
-		#pragma omp parallel for num_threads(s)
-		for(int n = 0; n < s; n++)
+		// Thread 0 is the caller and the rest go back to the OpenMP pool, both get their own mask back when the pipeline is done
+		void *Affinity = (Nodes > 1) ? SaveAffinity() : NULL;
+		int Node = omp_get_thread_num() % Nodes;
+		if(Nodes > 1 && !BindToNumaNode(Node))
+			Node = 0;
+		
+		for(int n = omp_get_thread_num(); n < Slots; n += omp_get_num_threads())
 		{
-			jam[n].Comp();
+			SlotNode[n] = (Nodes > 1) ? Node : 0;
+			if(Decode)
+				jam[n].InitDecomp(Opt);
+			else
+				CheckStatus(jam[n].InitComp(Opt));
 		}
-		for(int n = 0; n < s; n++)
+		#pragma omp barrier
+		
+		while(1)
 		{
-			jam[n].CompWriteBlock(out);
-			comp += *jam[n].Output.size;
+			int s = -1;
+			bool Stop = false, Tail = false;
+			uint64_t Seen;
+			
+			// Reader: claim a free instance and fill it with the next block of the input
+			#pragma omp critical(JamReader)
+			{
+				#pragma omp atomic read
+				Seen = Freed;
+				if(Eof)
+					Stop = true;
+				else
+				{
+					for(int n = 0; n < Slots && s < 0; n++)
+					{
+						int st;
+						#pragma omp atomic read
+						st = State[n];
+						if(st == SLOT_FREE && SlotNode[n] == Node)
+							s = n;
+					}
+					if(s >= 0)
+					{
+						#pragma omp flush
+						if(Decode)
+						{
+							int Read = feof(in) ? 0 : jam[s].DecompReadBlock(in);
+							CheckStatus(Read);
+							if(Read <= 0)
+							{
+								Eof = Stop = true;
+								s = -1;
+							}
+							else
+								ReadSize[s] = *jam[s].Input.size;
+						}
+						else
+						{
+							ReadSize[s] = jam[s].CompReadBlock(in);
+							Eof = feof(in) != 0;
+						}
+						if(s >= 0)
+						{
+							Sequence[s] = NextRead++;
+							Tail = Eof;
+							#pragma omp atomic write
+							State[s] = SLOT_BUSY;
+						}
+					}
+				}
+			}
+			if(Stop) 
+				break;
+			if(s < 0) // Every instance is queued behind the oldest block, wait for the writer to free one
+			{
+				while(1)
+				{
+					uint64_t f;
+					#pragma omp atomic read
+					f = Freed;
+					if(f != Seen)
+						break;
+					SleepMicroseconds(100);
+				}
+				continue;
+			}
+			
+			if(Decode)
+				CheckStatus(jam[s].Decomp());
+			else
+			{
+				int Blocks;
+				#pragma omp atomic capture
+				Blocks = ++Active;
+				jam[s].Option.SortThreads = __max(1, Cores / (Tail ? Blocks : (int)Opt.Threads)); // Until the input runs out every worker will be busy
+				CheckStatus(jam[s].Comp());
+				#pragma omp atomic
+				Active--;
+			}
+			
+			// Writer: emit every finished block that is next in line
+			#pragma omp critical(JamWriter)
+			{
+				State[s] = SLOT_DONE;
+				bool Flushed = true;
+				while(Flushed)
+				{
+					Flushed = false;
+					for(int n = 0; n < Slots; n++)
+					{
+						if(State[n] == SLOT_DONE && Sequence[n] == NextWrite)
+						{
+							if(Decode)
+							{
+								jam[n].DecompWriteBlock(out);
+								comp += ReadSize[n];
+								raw += *jam[n].Output.size;
+							}
+							else
+							{
+								if(Opt.BlockIndex)
+								{
+									if(EntryCount == EntryCapacity)
+									{
+										EntryCapacity = EntryCapacity ? EntryCapacity * 2 : 64;
+										Entries = (BlockEntry*)realloc(Entries, EntryCapacity * sizeof(BlockEntry));
+										if(Entries == NULL)
+											Error("Couldn't allocate block index!");
+									}
+									Entries[EntryCount].RawOffset = raw;
+									Entries[EntryCount].CompOffset = Written;
+									Entries[EntryCount].Crc = jam[n].crc;
+									EntryCount++;
+								}
+								Written += jam[n].CompWriteBlock(out);
+								raw += ReadSize[n];
+								comp += *jam[n].Output.size;
+							}
+							NextWrite++;
+							Flushed = true;
+							#pragma omp flush
+							#pragma omp atomic write
+							State[n] = SLOT_FREE;
+							#pragma omp atomic
+							Freed++;
+						}
+					}
+				}
+				
+				cur = clock();
+				ratio = ((double)comp / (double)raw) * 100;
+				double rate = (raw / (double)(1000000)) / (((double)cur - (double)start) / CLOCKS_PER_SEC);
+				if(Decode)
+					printf("Read: %.2f MB => %.2f MB (%.2f%%) @ %.2f MB/s        \r", (double)comp / (double)(1000000), (double)raw / (double)(1000000), ratio, rate);
+				else
+					printf("Read: %.2f MB => %.2f MB (%.2f%%) @ %.2f MB/s        \r", (double)raw / (double)(1000000), (double)comp / (double)(1000000), ratio, rate);
+			}
 		}
-		
-		cur = clock();
-		ratio = ((double)comp / (double)raw) * 100;
-		double rate = (raw / (double)(1000000)) / (((double)cur - (double)start) / CLOCKS_PER_SEC);
-		printf("Read: %.2f MB => %.2f MB (%.2f%%) @ %.2f MB/s        \r", (double)raw / (double)(1000000), (double)comp / (double)(1000000), ratio, rate);
+		RestoreAffinity(Affinity);
+	}
+	if(Decode)
+		printf("Read: %.2f MB => %.2f MB (%.2f%%)\n", (double)comp / (double)(1000000), (double)raw / (double)(1000000), ratio);
+	else
+		printf("Read: %.2f MB => %.2f MB (%.2f%%)\n", (double)raw / (double)(1000000), (double)comp / (double)(1000000), ratio);
+	
+	if(!Decode && Opt.BlockIndex)
+	{
+		WriteBlockIndex(out, Entries, EntryCount, raw);
+		free(Entries);
 	}
-	printf("Read: %.2f MB => %.2f MB (%.2f%%)\n", (double)raw / (double)(1000000), (double)comp / (double)(1000000), ratio);
 
-	for(int n = 0; n < (int)Opt.Threads; n++) 
+	omp_set_max_active_levels(Levels);
+
+	for(int n = 0; n < Slots; n++) 
 		jam[n].Free();
 	delete[] jam;
+	delete[] SlotNode;
+	delete[] State;
+	delete[] Sequence;
+	delete[] ReadSize;
+}
+
+/**
+* Compression always runs as a pipeline of block instances.
+*/
+void Jampack::Compress(FILE *in, FILE *out, Options Opt)
+{
+	if(Opt.Threads < MIN_THREADS) Opt.Threads = MIN_THREADS;
+	if(Opt.Threads > MAX_THREADS) Opt.Threads = MAX_THREADS;
+	if(Opt.BlockSize < MIN_BLOCKSIZE) Opt.BlockSize = MIN_BLOCKSIZE;
+	if(Opt.BlockSize > MAX_BLOCKSIZE) Opt.BlockSize = MAX_BLOCKSIZE;
+	if(Opt.SortOrder != 0 && Opt.SortOrder < ST_MIN_ORDER) Opt.SortOrder = ST_MIN_ORDER;
+	if(Opt.SortOrder > ST_MAX_ORDER) Opt.SortOrder = ST_MAX_ORDER;
+	
+	Pipeline(in, out, Opt, false);
 }
 
 /**
@@ -244,6 +560,13 @@ void Jampack::Decompress(FILE *in, FILE *out, Options Opt)
 {
 	if(Opt.Threads < MIN_THREADS) Opt.Threads = MIN_THREADS;
 	if(Opt.Threads > MAX_THREADS) Opt.Threads = MAX_THREADS;
+	
+	// Only extract part of the archive
+	if(Opt.RangeStart > 0 || Opt.RangeLength > 0)
+	{
+		DecompressRange(in, out, Opt);
+		return;
+	}
 		
 	// Decode using multiple threads working on a single block
 	if(Opt.Multiblock == false)
@@ -252,7 +575,7 @@ void Jampack::Decompress(FILE *in, FILE *out, Options Opt)
 		if(jam == NULL)
 			Error("Couldn't allocate decompressor!");
 		
-		jam->InitDecomp(Opt); // Set decoder to run with the selected number of threads on cpu or gpu (6N Memory)
+		jam->InitDecomp(Opt); // Set decoder to run with the selected number of threads on cpu or gpu (6N Memory, 2.5N in low memory mode)
 			
 		uint64_t raw = 0, comp = 0;
 		double ratio = 0;
@@ -262,13 +585,17 @@ void Jampack::Decompress(FILE *in, FILE *out, Options Opt)
 		while(1)
 		{ 
 			if(feof(in)) break;
-			if(jam->DecompReadBlock(in) > 0)
+			int Read = jam->DecompReadBlock(in);
+			CheckStatus(Read);
+			if(Read > 0)
 			{
 				comp += *jam->Input.size;		
-				jam->Decomp();
+				CheckStatus(jam->Decomp());
 				jam->DecompWriteBlock(out);
 				raw += *jam->Output.size;			
 			}
+			else
+				break;
 			
 			cur = clock();
 			ratio = ((double)comp / (double)raw) * 100;
@@ -280,57 +607,130 @@ void Jampack::Decompress(FILE *in, FILE *out, Options Opt)
 		jam->Free();
 		delete jam;
 	}
-	// Decode using multiple threads on multiple blocks with their own internal threads(6N*K Memory, very fast when there are multiple blocks available)
+	// Decode using multiple threads on multiple blocks with their own internal threads (6N*K Memory, very fast when there are multiple blocks available)
+	// Blocks are decoded out of order in a sliding window and written as soon as everything before them is written.
 	else
 	{
-		Jampack *jam = new Jampack[Opt.Threads];  
-		if(jam == NULL) 
-			Error("Couldn't allocate decompressor!");
-		
-		for(int n = 0; n < (int)Opt.Threads; n++) 
-			jam[n].InitDecomp(Opt); // This initializes twice the amount of threads the system has but allows for very flexible parallelism to take place
-		
-		uint64_t raw = 0, comp = 0;
-		double ratio = 0;
-		time_t start, cur;
-		start = clock();
-		
-		while(1)
-		{
-			if(feof(in)) break;
-			int s = 0;
-			while(!feof(in) && (s < Opt.Threads))
-			{
-				if(jam[s].DecompReadBlock(in) > 0)
-				{
-					comp += *jam[s].Input.size;		
-					s++;
-				}
-				else
-					break;
-			}
-			
-			#pragma omp parallel for num_threads(s)
-			for(int n = 0; n < s; n++)
-			{
-				jam[n].Decomp();
-			}
-			for(int n = 0; n < s; n++)
-			{
-				jam[n].DecompWriteBlock(out);
-				raw += *jam[n].Output.size;
-			}
+		Pipeline(in, out, Opt, true);
+	}
+}
 
-			cur = clock();
-			ratio = ((double)comp / (double)raw) * 100;
-			double rate = (raw / (double)(1000000)) / (((double)cur - (double)start) / CLOCKS_PER_SEC);
-			printf("Read: %.2f MB => %.2f MB (%.2f%%) @ %.2f MB/s        \r", (double)comp / (double)(1000000), (double)raw / (double)(1000000), ratio, rate);
-		}
-		printf("Read: %.2f MB => %.2f MB (%.2f%%)\n", (double)comp / (double)(1000000), (double)raw / (double)(1000000), ratio);
+/**
+* 64-bit safe seeking, archives easily exceed 2 GB.
+*/
+static int SeekArchive(FILE *f, int64_t offset, int origin)
+{
+#ifdef _WIN32
+	return _fseeki64(f, offset, origin);
+#else
+	return fseeko(f, offset, origin);
+#endif
+}
+
+/**
+* The index is written after the last block so streaming writers never have to seek back.
+* A trailer at the very end holds the index size, readers find the index by seeking from the end of the archive.
+*/
+void Jampack::WriteBlockIndex(FILE *out, BlockEntry *Entries, unsigned int Count, uint64_t RawTotal)
+{
+	uint64_t IndexSize = strlen(IndexMagic) + sizeof(unsigned int) + Count * (2 * sizeof(uint64_t) + sizeof(unsigned int)) + 2 * sizeof(uint64_t) + strlen(IndexMagic);
+	fwrite(&IndexMagic, 1, strlen(IndexMagic), out);
+	fwrite(&Count, 1, sizeof(unsigned int), out);
+	for(unsigned int i = 0; i < Count; i++)
+	{
+		fwrite(&Entries[i].RawOffset, 1, sizeof(uint64_t), out);
+		fwrite(&Entries[i].CompOffset, 1, sizeof(uint64_t), out);
+		fwrite(&Entries[i].Crc, 1, sizeof(unsigned int), out);
+	}
+	fwrite(&RawTotal, 1, sizeof(uint64_t), out);
+	fwrite(&IndexSize, 1, sizeof(uint64_t), out);
+	fwrite(&IndexMagic, 1, strlen(IndexMagic), out);
+}
+
+BlockEntry *Jampack::ReadBlockIndex(FILE *in, unsigned int *Count, uint64_t *RawTotal)
+{
+	char Magic_check[MagicLength+1] = {0};
+	uint64_t IndexSize = 0;
+	if(SeekArchive(in, -(int64_t)(strlen(IndexMagic) + sizeof(uint64_t)), SEEK_END) != 0)
+		return NULL;
+	if(fread(&IndexSize, 1, sizeof(uint64_t), in) != sizeof(uint64_t) || fread(&Magic_check, 1, strlen(IndexMagic), in) != strlen(IndexMagic))
+		return NULL;
+	if(strcmp(Magic_check, IndexMagic) != 0)
+		return NULL;
+	
+	if(SeekArchive(in, -(int64_t)IndexSize, SEEK_END) != 0)
+		Error("Refusing to read from corrupt block index!");
+	memset(Magic_check, 0, sizeof(Magic_check));
+	if(fread(&Magic_check, 1, strlen(IndexMagic), in) != strlen(IndexMagic) || fread(Count, 1, sizeof(unsigned int), in) != sizeof(unsigned int))
+		Error("Refusing to read from corrupt block index!");
+	if(strcmp(Magic_check, IndexMagic) != 0 || IndexSize != strlen(IndexMagic) + sizeof(unsigned int) + *Count * (2 * sizeof(uint64_t) + sizeof(unsigned int)) + 2 * sizeof(uint64_t) + strlen(IndexMagic))
+		Error("Refusing to read from corrupt block index!");
+	
+	BlockEntry *Entries = (BlockEntry*)malloc((*Count + 1) * sizeof(BlockEntry));
+	if(Entries == NULL)
+		Error("Couldn't allocate block index!");
+	bool Valid = true;
+	for(unsigned int i = 0; i < *Count && Valid; i++)
+	{
+		Valid = fread(&Entries[i].RawOffset, 1, sizeof(uint64_t), in) == sizeof(uint64_t) &&
+			fread(&Entries[i].CompOffset, 1, sizeof(uint64_t), in) == sizeof(uint64_t) &&
+			fread(&Entries[i].Crc, 1, sizeof(unsigned int), in) == sizeof(unsigned int);
+	}
+	if(!Valid || fread(RawTotal, 1, sizeof(uint64_t), in) != sizeof(uint64_t))
+		Error("Refusing to read from corrupt block index!");
+	return Entries;
+}
+
+/**
+* Random access decoding, the block index points at the first block holding Opt.RangeStart,
+* only the blocks overlapping the range are read and decoded (each one with all threads working on it).
+*/
+void Jampack::DecompressRange(FILE *in, FILE *out, Options Opt)
+{
+	unsigned int Count = 0;
+	uint64_t RawTotal = 0;
+	BlockEntry *Entries = ReadBlockIndex(in, &Count, &RawTotal);
+	if(Entries == NULL)
+		Error("Range decoding needs a seekable archive with a block index (compress with -i)!");
+	
+	uint64_t First = Opt.RangeStart;
+	uint64_t Last = (Opt.RangeLength == 0 || Opt.RangeLength > RawTotal - __min(First, RawTotal)) ? RawTotal : First + Opt.RangeLength;
+	
+	Jampack *jam = new Jampack();
+	if(jam == NULL)
+		Error("Couldn't allocate decompressor!");
+	jam->InitDecomp(Opt);
+	
+	uint64_t raw = 0, comp = 0;
+	for(unsigned int b = 0; b < Count && First < Last; b++)
+	{
+		uint64_t BlockEnd = (b + 1 < Count) ? Entries[b + 1].RawOffset : RawTotal;
+		if(BlockEnd <= First)
+			continue;
+		if(Entries[b].RawOffset >= Last)
+			break;
 		
+		if(SeekArchive(in, Entries[b].CompOffset, SEEK_SET) != 0)
+			Error("Block index points outside of the archive!");
+		int Read = jam->DecompReadBlock(in);
+		CheckStatus(Read);
+		if(Read <= 0)
+			Error("Block index points outside of the archive!");
+		if(jam->crc != Entries[b].Crc)
+			Error("Block index does not match the archive!");
+		comp += *jam->Input.size;
+		CheckStatus(jam->Decomp());
+		if(BlockEnd < Entries[b].RawOffset || (uint64_t)*jam->Output.size != BlockEnd - Entries[b].RawOffset) // The range is cut out of the block by the offsets of the index
+			Error("Block index does not match the archive!");
 		
-		for(int n = 0; n < (int)Opt.Threads; n++) 
-			jam[n].Free();
-		delete jam;
+		uint64_t From = (First > Entries[b].RawOffset) ? First - Entries[b].RawOffset : 0;
+		uint64_t To = __min(Last, BlockEnd) - Entries[b].RawOffset;
+		fwrite(&jam->Output.block[From], 1, To - From, out);
+		raw += To - From;
 	}
+	printf("Read: %.2f MB => %.2f MB (range %llu to %llu)\n", (double)comp / (double)(1000000), (double)raw / (double)(1000000), (unsigned long long)First, (unsigned long long)Last);
+	
+	jam->Free();
+	delete jam;
+	free(Entries);
 }
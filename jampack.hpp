@@ -11,6 +11,7 @@
 #include "checksum.hpp"
 #include "filters.hpp"
 #include "lpx.hpp"
+#include "arena.hpp"
 
 class Jampack
 {
@@ -25,20 +26,32 @@ class Jampack
 	Filters *Filter;			// Generic filters 
 	Lpx *LocalModel;			// Local bijective low-order match model
 	Checksum *Chk;				// Fast checksum implementation
+	Arena *Scratch;				// Workspace all stages borrow their temporary memory from
 	Options Option;				// Optional compression arguments are passed through the 'Options' type
 	Index BlockSize;
 	unsigned int crc;
 	
+	int WriteBlockHeader(unsigned char *header);	// Serialize the block header
+	static int CheckBlockHeader(const unsigned char *header); // Validate a block header before its payload is read, returns JAM_OK or a negative status
+	int ReadBlockHeader(const unsigned char *header); // Parse and validate a block header, returns JAM_OK or a negative status
+	void CreateStages(Options Opt);		// Allocate the workspace arena and the stages borrowing from it
+	
+	void Pipeline(FILE *in, FILE *out, Options Opt, bool Decode); // Run blocks through a ring of instances with ordered output
+	void WriteBlockIndex(FILE *out, BlockEntry *Entries, unsigned int Count, uint64_t RawTotal); // Append the block index trailer
+	BlockEntry *ReadBlockIndex(FILE *in, unsigned int *Count, uint64_t *RawTotal); // Load the block index trailer, NULL if there is none
+	
 	public:
-	void Comp(); 				// Compress buffer
-	void Decomp(); 				// Decompress buffer
-	void InitComp(Options Opt); 		// Initialize compressor with blocksize bsize
+	int Comp(); 				// Compress buffer, JAM_OK or JAM_ERROR_MEMORY
+	int Decomp(); 				// Decompress buffer, returns JAM_OK or a negative status
+	int InitComp(Options Opt); 		// Initialize compressor with blocksize bsize, returns JAM_OK or JAM_ERROR_MEMORY
 	void InitDecomp(Options Opt); 		// Initialize decoder with t threads on either cpu or gpu
 	void Free(); 				// Release memory from the compressor or decompressor
 	
 	int CompReadBlock(FILE *in);		// Read raw input to compressor
-	int DecompReadBlock(FILE *in); 		// Read compressed block to decompressor
-	void CompWriteBlock(FILE *out); 	// Write compressed contents to output
+	int DecompReadBlock(FILE *in); 		// Read compressed block to decompressor, returns its size, 0 at the end, or a negative status
+	uint64_t CompWriteBlock(FILE *out); 	// Write compressed contents to output, returns the bytes written
+	uint64_t CompWriteBlock(unsigned char *out); // Write compressed contents to memory, returns the bytes written
+	int64_t DecompReadBlock(const unsigned char *in, uint64_t len); // Read compressed block from memory, returns the bytes consumed
 	void DecompWriteBlock(FILE *out); 	// Write out extracted data
 	
 	void SwapStreams();			// Swap input stream with output stream
@@ -46,5 +59,6 @@ class Jampack
 	
 	void Compress(FILE *in, FILE *out, Options Opt); 	// Compress input file to output file
 	void Decompress(FILE *in, FILE *out, Options Opt); 	// Decompress input to output 
+	void DecompressRange(FILE *in, FILE *out, Options Opt); // Decompress only Opt.RangeStart to Opt.RangeStart + Opt.RangeLength using the block index
 };
 #endif // JAM_H //
@@ -0,0 +1,303 @@
+/*********************************************
+* Library interface for embedding Jampack
+* Contexts hold one compressor and one decompressor instance which are only initialized once,
+* every call after that reuses their buffers and stages.
+**********************************************/
+#include "libjampack.hpp"
+#include "jampack.hpp"
+
+struct JamContext
+{
+	Options Opt;
+	Jampack Comp;				// Compressor instance, its Input buffer doubles as the staging area for pushed data
+	Jampack Decomp;				// Decompressor instance, only initialized once it's needed
+	bool CompReady;
+	bool DecompReady;
+	bool StreamEnded;			// The streaming decoder reached the block index trailer
+
+	unsigned char *Queue;			// Streamed output waiting to be pulled
+	size_t QueueSize, QueueRead, QueueCapacity;
+
+	unsigned char *Stage;			// Compressed bytes waiting for the rest of their block
+	size_t StageSize, StageCapacity;
+};
+
+/**
+* Make room for at least 'len' more bytes at the end of a growable buffer, false if it couldn't grow (the buffer is left as it was)
+*/
+static bool Reserve(unsigned char **buf, size_t used, size_t *capacity, size_t len)
+{
+	if(used + len > *capacity)
+	{
+		size_t grow = (*capacity) ? *capacity * 2 : (1 << 20);
+		while(grow < used + len)
+			grow *= 2;
+		unsigned char *Grown = (unsigned char*)realloc(*buf, grow);
+		if(Grown == NULL)
+			return false;
+		*buf = Grown;
+		*capacity = grow;
+	}
+	return true;
+}
+
+static int PrepareCompressor(JamContext *Ctx)
+{
+	if(!Ctx->CompReady)
+	{
+		int Status = Ctx->Comp.InitComp(Ctx->Opt);
+		if(Status != JAM_OK)
+		{
+			Ctx->Comp.Free(); // The next call tries again
+			return Status;
+		}
+		*Ctx->Comp.Input.size = 0;
+		Ctx->CompReady = true;
+	}
+	return JAM_OK;
+}
+
+static void PrepareDecompressor(JamContext *Ctx)
+{
+	if(!Ctx->DecompReady)
+	{
+		Ctx->Decomp.InitDecomp(Ctx->Opt);
+		Ctx->DecompReady = true;
+	}
+}
+
+/**
+* Compress whatever is staged in the compressor and queue the block
+*/
+static int FlushStagedBlock(JamContext *Ctx)
+{
+	Jampack *jam = &Ctx->Comp;
+	int Status = jam->Comp();
+	*jam->Input.size = 0; // Comp() swapped the streams, restart staging on the new input buffer
+	if(Status != JAM_OK)
+		return Status;
+	if(!Reserve(&Ctx->Queue, Ctx->QueueSize, &Ctx->QueueCapacity, BLOCK_HEADER_SIZE + *jam->Output.size))
+		return JAM_ERROR_MEMORY;
+	Ctx->QueueSize += jam->CompWriteBlock(&Ctx->Queue[Ctx->QueueSize]);
+	return JAM_OK;
+}
+
+void JamDefaultParams(JamParams *Params)
+{
+	Params->BlockSize = DEFAULT_BLOCKSIZE;
+	Params->Threads = MAX_THREADS;
+	Params->MatchFinder = 0;
+	Params->Filters = 1;
+	Params->EntropyMode = 0;
+	Params->SortOrder = 0;
+}
+
+JamContext *JamCreateContext(const JamParams *Params)
+{
+	JamContext *Ctx = new JamContext();
+
+	Options Opt;
+	memset(&Opt, 0, sizeof(Options));
+	Opt.BlockSize = Params->BlockSize;
+	Opt.Threads = Params->Threads;
+	Opt.MatchFinder = Params->MatchFinder;
+	Opt.Filters = Params->Filters;
+	Opt.EntropyMode = Params->EntropyMode;
+	Opt.SortOrder = Params->SortOrder;
+	Opt.Gpu = false;
+	Opt.Multiblock = false;
+
+	if(Opt.Threads < MIN_THREADS) Opt.Threads = MIN_THREADS;
+	if(Opt.Threads > MAX_THREADS) Opt.Threads = MAX_THREADS;
+	Opt.SortThreads = Opt.Threads; // Blocks are compressed one at a time, the sort can have every thread
+	if(Opt.BlockSize < MIN_BLOCKSIZE) Opt.BlockSize = MIN_BLOCKSIZE;
+	if(Opt.BlockSize > MAX_BLOCKSIZE) Opt.BlockSize = MAX_BLOCKSIZE;
+	if(Opt.SortOrder != 0 && Opt.SortOrder < ST_MIN_ORDER) Opt.SortOrder = ST_MIN_ORDER;
+	if(Opt.SortOrder > ST_MAX_ORDER) Opt.SortOrder = ST_MAX_ORDER;
+
+	Ctx->Opt = Opt;
+	Ctx->CompReady = false;
+	Ctx->DecompReady = false;
+	Ctx->StreamEnded = false;
+	Ctx->Queue = NULL;
+	Ctx->QueueSize = Ctx->QueueRead = Ctx->QueueCapacity = 0;
+	Ctx->Stage = NULL;
+	Ctx->StageSize = Ctx->StageCapacity = 0;
+	return Ctx;
+}
+
+void JamFreeContext(JamContext *Ctx)
+{
+	if(Ctx == NULL)
+		return;
+	if(Ctx->CompReady)
+		Ctx->Comp.Free();
+	if(Ctx->DecompReady)
+		Ctx->Decomp.Free();
+	free(Ctx->Queue);
+	free(Ctx->Stage);
+	delete Ctx;
+}
+
+size_t JamCompressBound(const JamContext *Ctx, size_t Length)
+{
+	size_t Blocks = (Length + Ctx->Opt.BlockSize - 1) / Ctx->Opt.BlockSize;
+	return Blocks * (BLOCK_HEADER_SIZE + (size_t)((int)(Ctx->Opt.BlockSize) * 1.05));
+}
+
+int64_t JamCompressBuffer(JamContext *Ctx, const void *Src, size_t SrcLen, void *Dst, size_t DstCap)
+{
+	int Status = PrepareCompressor(Ctx);
+	if(Status != JAM_OK)
+		return Status;
+	Jampack *jam = &Ctx->Comp;
+	const unsigned char *in = (const unsigned char*)Src;
+	unsigned char *out = (unsigned char*)Dst;
+
+	size_t out_p = 0;
+	for(size_t in_p = 0; in_p < SrcLen; )
+	{
+		Index len = (SrcLen - in_p < (size_t)Ctx->Opt.BlockSize) ? (Index)(SrcLen - in_p) : Ctx->Opt.BlockSize;
+		memcpy(jam->Input.block, &in[in_p], len);
+		*jam->Input.size = len;
+		Status = jam->Comp();
+		if(Status != JAM_OK)
+		{
+			*jam->Input.size = 0;
+			return Status;
+		}
+		if(out_p + BLOCK_HEADER_SIZE + *jam->Output.size > DstCap)
+		{
+			*jam->Input.size = 0;
+			return JAM_ERROR_DST_SIZE;
+		}
+		out_p += jam->CompWriteBlock(&out[out_p]);
+		in_p += len;
+	}
+	*jam->Input.size = 0;
+	return out_p;
+}
+
+int64_t JamDecompressBuffer(JamContext *Ctx, const void *Src, size_t SrcLen, void *Dst, size_t DstCap)
+{
+	PrepareDecompressor(Ctx);
+	Jampack *jam = &Ctx->Decomp;
+	const unsigned char *in = (const unsigned char*)Src;
+	unsigned char *out = (unsigned char*)Dst;
+
+	size_t out_p = 0;
+	for(size_t in_p = 0; in_p < SrcLen; )
+	{
+		int64_t used = jam->DecompReadBlock(&in[in_p], SrcLen - in_p);
+		if(used == -1) // Block index trailer
+			break;
+		if(used < 0)
+			return used;
+		if(used == 0) // Truncated compressed buffer
+			return JAM_ERROR_CORRUPT;
+		int Status = jam->Decomp();
+		if(Status != JAM_OK)
+			return Status;
+		if(out_p + *jam->Output.size > DstCap)
+			return JAM_ERROR_DST_SIZE;
+		memcpy(&out[out_p], jam->Output.block, *jam->Output.size);
+		out_p += *jam->Output.size;
+		in_p += used;
+	}
+	return out_p;
+}
+
+int JamCompressPush(JamContext *Ctx, const void *Src, size_t Length)
+{
+	int Status = PrepareCompressor(Ctx);
+	if(Status != JAM_OK)
+		return Status;
+	Jampack *jam = &Ctx->Comp;
+	const unsigned char *in = (const unsigned char*)Src;
+
+	while(Length > 0)
+	{
+		size_t room = Ctx->Opt.BlockSize - *jam->Input.size;
+		size_t len = (Length < room) ? Length : room;
+		memcpy(&jam->Input.block[*jam->Input.size], in, len);
+		*jam->Input.size += len;
+		in += len;
+		Length -= len;
+		if(*jam->Input.size == Ctx->Opt.BlockSize && (Status = FlushStagedBlock(Ctx)) != JAM_OK)
+			return Status;
+	}
+	return JAM_OK;
+}
+
+int JamCompressFinish(JamContext *Ctx)
+{
+	int Status = PrepareCompressor(Ctx);
+	if(Status == JAM_OK && *Ctx->Comp.Input.size > 0)
+		Status = FlushStagedBlock(Ctx);
+	return Status;
+}
+
+int64_t JamDecompressPush(JamContext *Ctx, const void *Src, size_t Length)
+{
+	PrepareDecompressor(Ctx);
+	Jampack *jam = &Ctx->Decomp;
+	if(Ctx->StreamEnded)
+		return 0;
+
+	if(!Reserve(&Ctx->Stage, Ctx->StageSize, &Ctx->StageCapacity, Length))
+		return JAM_ERROR_MEMORY;
+	memcpy(&Ctx->Stage[Ctx->StageSize], Src, Length);
+	Ctx->StageSize += Length;
+
+	size_t pos = 0;
+	int Status = JAM_OK;
+	while(pos < Ctx->StageSize)
+	{
+		int64_t used = jam->DecompReadBlock(&Ctx->Stage[pos], Ctx->StageSize - pos);
+		if(used == -1) // Everything after the last block is the block index
+		{
+			Ctx->StreamEnded = true;
+			pos = Ctx->StageSize;
+			break;
+		}
+		if(used == 0) // The rest of the block hasn't been pushed yet
+			break;
+		if(used < 0)
+		{
+			Status = (int)used;
+			break;
+		}
+		if((Status = jam->Decomp()) != JAM_OK)
+			break;
+		if(!Reserve(&Ctx->Queue, Ctx->QueueSize, &Ctx->QueueCapacity, *jam->Output.size))
+		{
+			Status = JAM_ERROR_MEMORY;
+			break;
+		}
+		memcpy(&Ctx->Queue[Ctx->QueueSize], jam->Output.block, *jam->Output.size);
+		Ctx->QueueSize += *jam->Output.size;
+		pos += used;
+	}
+	memmove(Ctx->Stage, &Ctx->Stage[pos], Ctx->StageSize - pos);
+	Ctx->StageSize -= pos;
+	if(Status != JAM_OK) // The failed block stays staged, every further push reports it again
+		return Status;
+	return Ctx->StageSize;
+}
+
+size_t JamPull(JamContext *Ctx, void *Dst, size_t Capacity)
+{
+	size_t len = Ctx->QueueSize - Ctx->QueueRead;
+	if(len > Capacity)
+		len = Capacity;
+	memcpy(Dst, &Ctx->Queue[Ctx->QueueRead], len);
+	Ctx->QueueRead += len;
+	if(Ctx->QueueRead == Ctx->QueueSize)
+		Ctx->QueueRead = Ctx->QueueSize = 0;
+	return len;
+}
+
+size_t JamPending(const JamContext *Ctx)
+{
+	return Ctx->QueueSize - Ctx->QueueRead;
+}
@@ -0,0 +1,96 @@
+/*********************************************
+* Library interface for embedding Jampack
+* A context keeps its compressor and decompressor instances (buffers, stages and scratch) alive between calls,
+* so a server can compress many requests without temp files or per-request allocation churn.
+* The produced stream is the same archive format the command-line tool reads and writes.
+*
+* There are two ways of feeding a context:
+* 1) buffer to buffer : JamCompressBuffer / JamDecompressBuffer
+* 2) streaming : push input with JamCompressPush / JamDecompressPush and pull the results with JamPull
+* Buffer calls reuse the staging area of the streaming compressor, so don't mix them while a stream is unfinished.
+**********************************************/
+#ifndef LIBJAMPACK_H
+#define LIBJAMPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct JamContext JamContext;
+
+/**
+* Calls that can fail return one of these negative codes, a library call never exits the process
+*/
+#define JAM_ERROR_DST_SIZE	-1	// The destination buffer is too small
+#define JAM_ERROR_CORRUPT	-2	// The compressed data is truncated or corrupt
+#define JAM_ERROR_MEMORY	-3	// The context couldn't allocate its buffers or the workspace of a stage
+#define JAM_ERROR_VERSION	-4	// The data was written by a newer version with a block format this one can't read
+
+/**
+* Compression arguments, these match the command-line options
+*/
+typedef struct
+{
+	int BlockSize; 		// Size of a block in bytes
+	int Threads; 		// Threads working on a single block
+	int MatchFinder; 	// 0 = dedupe, 1 = positional context hash chain, 2 = anti-context suffix array
+	int Filters; 		// 0 = disable, 1 = heuristic, 2 = brute force
+	int EntropyMode; 	// 0 = four byte-wise rANS states, 1 = eight SIMD decoded lanes, 2 = static tANS
+	int SortOrder; 		// 0 = full BWT, 3 to 8 = limited context sort of that order
+} JamParams;
+
+/**
+* Fill the arguments with the command-line defaults
+*/
+void JamDefaultParams(JamParams *Params);
+
+/**
+* Create and release a context, a context must only be used by one thread at a time
+*/
+JamContext *JamCreateContext(const JamParams *Params);
+void JamFreeContext(JamContext *Ctx);
+
+/**
+* Worst case size of a compressed buffer of Length bytes
+*/
+size_t JamCompressBound(const JamContext *Ctx, size_t Length);
+
+/**
+* Buffer to buffer de/compression, returns the amount of bytes written to Dst, -1 (JAM_ERROR_DST_SIZE) if Dst is too small,
+* JAM_ERROR_CORRUPT if Src is truncated or corrupt, JAM_ERROR_VERSION, or JAM_ERROR_MEMORY
+*/
+int64_t JamCompressBuffer(JamContext *Ctx, const void *Src, size_t SrcLen, void *Dst, size_t DstCap);
+int64_t JamDecompressBuffer(JamContext *Ctx, const void *Src, size_t SrcLen, void *Dst, size_t DstCap);
+
+/**
+* Streaming compression, every full block is compressed as soon as it has been pushed.
+* JamCompressFinish compresses whatever is left of the last block. Both return 0 or JAM_ERROR_MEMORY.
+*/
+int JamCompressPush(JamContext *Ctx, const void *Src, size_t Length);
+int JamCompressFinish(JamContext *Ctx);
+
+/**
+* Streaming decompression, every block is decoded as soon as it has been completely pushed.
+* Returns the amount of bytes still waiting for the rest of their block, or JAM_ERROR_CORRUPT / JAM_ERROR_VERSION / JAM_ERROR_MEMORY.
+* The blocks before a failure stay queued for JamPull, the stream can't be continued after it.
+*/
+int64_t JamDecompressPush(JamContext *Ctx, const void *Src, size_t Length);
+
+/**
+* Drain up to Capacity bytes of streamed output, returns the amount copied to Dst
+*/
+size_t JamPull(JamContext *Ctx, void *Dst, size_t Capacity);
+
+/**
+* Amount of streamed output waiting to be pulled
+*/
+size_t JamPending(const JamContext *Ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBJAMPACK_H
@@ -55,12 +55,9 @@ void Lpx::UpdateTable(PrefixRecord **table, unsigned int *cxt, unsigned int pos,
 
 void Lpx::EncodeBlock(unsigned char *input, unsigned char *output, Index len)
 {
-	PrefixRecord *table[3];
-	table[0] = (PrefixRecord*)calloc(256, sizeof(PrefixRecord));
-	table[1] = (PrefixRecord*)calloc(256, sizeof(PrefixRecord));
-	table[2] = (PrefixRecord*)calloc(256, sizeof(PrefixRecord));
-	if(table[0] == NULL || table[1] == NULL || table[2] == NULL )
-		Error("Could not allocate prefix model!");
+	PrefixRecord records[3][256]; // Small enough to live on the stack of each worker
+	memset(records, 0, sizeof(records));
+	PrefixRecord *table[3] = {records[0], records[1], records[2]};
 	for(int i = 0; i < 256; i++)
 	{
 		table[0][i].threshold = MaxThreshold >> 1;
@@ -93,19 +90,13 @@ void Lpx::EncodeBlock(unsigned char *input, unsigned char *output, Index len)
 			i++;
 		}
 	}
-	free(table[0]);
-	free(table[1]);
-	free(table[2]);
 }
 
 void Lpx::DecodeBlock(unsigned char *input, unsigned char *output, Index len)
 {
-	PrefixRecord *table[3];
-	table[0] = (PrefixRecord*)calloc(256, sizeof(PrefixRecord));
-	table[1] = (PrefixRecord*)calloc(256, sizeof(PrefixRecord));
-	table[2] = (PrefixRecord*)calloc(256, sizeof(PrefixRecord));
-	if(table[0] == NULL || table[1] == NULL || table[2] == NULL )
-		Error("Could not allocate prefix model!");
+	PrefixRecord records[3][256]; // Small enough to live on the stack of each worker
+	memset(records, 0, sizeof(records));
+	PrefixRecord *table[3] = {records[0], records[1], records[2]};
 	for(int i = 0; i < 256; i++)
 	{
 		table[0][i].threshold = MaxThreshold >> 1;
@@ -139,10 +130,6 @@ void Lpx::DecodeBlock(unsigned char *input, unsigned char *output, Index len)
 			i++;
 		}
 	}
-
-	free(table[0]);
-	free(table[1]);
-	free(table[2]);
 }
 
 void Lpx::Encode(Buffer Input, Buffer Output, Options Opt)
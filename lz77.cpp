@@ -8,9 +8,10 @@
 /**
 * Initialize the leb128 reader/writer  
 */
-Lz77::Lz77()
+Lz77::Lz77(Arena *Scratch)
 {
 	Leb = new Utils();
+	Workspace = Scratch;
 }
 
 /**
@@ -122,21 +123,26 @@ float Lz77::Compressible(Index match, Index literal, Index offset)
 * Compress input block to output block
 * Note: unlike any other lz77 encoder this uses anti-context parsing, basically any non-markovian contexts and high lcp strings are encoded here.
 * Arguments: -m0 = dedupe, -m1 = hash chain positional modeling, -m2 full anti-context modeling.
+* Returns JAM_OK, or JAM_ERROR_MEMORY if the match finder tables can't be allocated.
 */
-void Lz77::Compress(Buffer Input, Buffer Output, Options Opt)
+int Lz77::Compress(Buffer Input, Buffer Output, Options Opt)
 {
 	if(Opt.MatchFinder < 0)
 		Opt.MatchFinder = 0;
 	if(Opt.MatchFinder > 2)
 		Opt.MatchFinder = 2;
 	int mode = Opt.MatchFinder;
+	size_t mark = Workspace->Mark();
 
 	if(mode == 2) // smallest but slowest (activated with -m2 flag) suffix array modeling, uses ISA and SA (note: incredibly slow)
 	{
-		Index *SA = (Index*)malloc(*Input.size * sizeof(Index)); 
-		Index *ISA = (Index*)malloc(*Input.size * sizeof(Index)); 
+		Index *SA = Workspace->Alloc<Index>(*Input.size); 
+		Index *ISA = Workspace->Alloc<Index>(*Input.size); 
 		if(SA == NULL || ISA == NULL)
-			Error("Failed to allocate lz77 suffix array components!");
+		{
+			Workspace->Release(mark);
+			return JAM_ERROR_MEMORY;
+		}
 		
 		if(divsufsort(Input.block, SA, *Input.size) != 0) 
 			Error("Failure computing the Suffix Array!");
@@ -144,9 +150,6 @@ void Lz77::Compress(Buffer Input, Buffer Output, Options Opt)
 		for(Index i = 0; i < *Input.size; i++)
 			ISA[SA[i]] = i;
 		
-		CyclicHashHistory *ChhmOffset = new CyclicHashHistory(TOKEN_BUFFER_SIZE);
-		CyclicHashHistory *ChhmMatch = new CyclicHashHistory(TOKEN_BUFFER_SIZE);
-		
 		struct Token
 		{
 			Index offset;
@@ -154,9 +157,16 @@ void Lz77::Compress(Buffer Input, Buffer Output, Options Opt)
 			Index position;
 		};
 		
-		Token *TokenBuffer = (Token*)calloc(TOKEN_BUFFER_SIZE, sizeof(Token));
+		Token *TokenBuffer = Workspace->Alloc<Token>(TOKEN_BUFFER_SIZE);
 		if(TokenBuffer == NULL)
-			Error("Failed to allocate token buffer!");
+		{
+			Workspace->Release(mark);
+			return JAM_ERROR_MEMORY;
+		}
+		memset(TokenBuffer, 0, TOKEN_BUFFER_SIZE * sizeof(Token));
+		
+		CyclicHashHistory *ChhmOffset = new CyclicHashHistory(TOKEN_BUFFER_SIZE);
+		CyclicHashHistory *ChhmMatch = new CyclicHashHistory(TOKEN_BUFFER_SIZE);
 
 		unsigned int h = 0;
 		Index pos = 0, lit = 0; // positions in match finder
@@ -266,9 +276,6 @@ void Lz77::Compress(Buffer Input, Buffer Output, Options Opt)
 		memcpy(&Output.block[out_pos], &Input.block[*Input.size - remainder], remainder);
 		out_pos += remainder;
 		*Output.size = out_pos;
-		free(SA);
-		free(ISA);
-		free(TokenBuffer);
 		delete ChhmOffset;
 		delete ChhmMatch;
 	}
@@ -277,9 +284,6 @@ void Lz77::Compress(Buffer Input, Buffer Output, Options Opt)
 	// random tokens are useless and imply that there is context (which bwt can handle far better), repeating tokens imply an underlying structure that bwt cannot see and is deemed worth compressing with lz77.
 	else if(mode == 1) // hash chain match finding (activated with -m1 flag)
 	{
-		CyclicHashHistory *ChhmOffset = new CyclicHashHistory(TOKEN_BUFFER_SIZE);
-		CyclicHashHistory *ChhmMatch = new CyclicHashHistory(TOKEN_BUFFER_SIZE);
-		
 		struct Token
 		{
 			Index offset;
@@ -287,18 +291,22 @@ void Lz77::Compress(Buffer Input, Buffer Output, Options Opt)
 			Index position;
 		};
 		
-		Token *TokenBuffer = (Token*)calloc(TOKEN_BUFFER_SIZE, sizeof(Token));
-		if(TokenBuffer == NULL)
-			Error("Failed to allocate token buffer!");
-		
+		Token *TokenBuffer = Workspace->Alloc<Token>(TOKEN_BUFFER_SIZE);
 		Index Window = *Input.size;
-		Index *chain = (Index*)malloc(Window * sizeof(Index)); // Hash chained table
-		Index *table = (Index*)malloc(HASH_SIZE * sizeof(Index)); // Auxiliary hash
-		if(table == NULL || chain == NULL)
-			Error("Failed to allocate lz77 match table!");
+		Index *chain = Workspace->Alloc<Index>(Window); // Hash chained table
+		Index *table = Workspace->Alloc<Index>(HASH_SIZE); // Auxiliary hash
+		if(TokenBuffer == NULL || chain == NULL || table == NULL)
+		{
+			Workspace->Release(mark);
+			return JAM_ERROR_MEMORY;
+		}
 		
+		memset(TokenBuffer, 0, TOKEN_BUFFER_SIZE * sizeof(Token));
 		memset(table, 0, HASH_SIZE * sizeof(Index));
 		memset(chain, 0, Window * sizeof(Index));
+		
+		CyclicHashHistory *ChhmOffset = new CyclicHashHistory(TOKEN_BUFFER_SIZE);
+		CyclicHashHistory *ChhmMatch = new CyclicHashHistory(TOKEN_BUFFER_SIZE);
 
 		unsigned int h = 0;
 		Index pos = 0, lit = 0; // positions in match finder
@@ -433,9 +441,6 @@ void Lz77::Compress(Buffer Input, Buffer Output, Options Opt)
 		memcpy(&Output.block[out_pos], &Input.block[*Input.size - remainder], remainder);
 		out_pos += remainder;
 		*Output.size = out_pos;
-		free(chain);
-		free(table);
-		free(TokenBuffer);
 		delete ChhmOffset;
 		delete ChhmMatch;
 		
@@ -544,9 +549,12 @@ void Lz77::Compress(Buffer Input, Buffer Output, Options Opt)
 	// Fast dedupe (activated with -m0 flag)
 	else
 	{		
-		Index *table = (Index*)malloc(HASH_SIZE * sizeof(Index)); // Auxiliary hash
+		Index *table = Workspace->Alloc<Index>(HASH_SIZE); // Auxiliary hash
 		if(table == NULL)
-			Error("Failed to allocate lz77 dedupe table!");
+		{
+			Workspace->Release(mark);
+			return JAM_ERROR_MEMORY;
+		}
 		memset(table, 0, HASH_SIZE * sizeof(Index));
 
 		int shift = (DUPE_MATCH > 32) ? 1 : 32 / DUPE_MATCH;
@@ -621,8 +629,9 @@ void Lz77::Compress(Buffer Input, Buffer Output, Options Opt)
 		memcpy(&Output.block[out_pos], &Input.block[pos - lit], lit);
 		out_pos += lit;
 		*Output.size = out_pos;
-		free(table);
 	}
+	Workspace->Release(mark);
+	return JAM_OK;
 }
 
 /**
@@ -673,9 +682,9 @@ void Lz77::FastCopy(unsigned char *dest, unsigned char *src, Index length)
 }
 
 /**
-* Decompress input to output
+* Decompress input to output, returns JAM_OK or JAM_ERROR_CORRUPT if a token points outside of the data or runs past the output buffer
 */
-void Lz77::Decompress(Buffer Input, Buffer Output)
+int Lz77::Decompress(Buffer Input, Buffer Output)
 {
 	Index lit = 0;
 	Index len = 0;
@@ -685,18 +694,22 @@ void Lz77::Decompress(Buffer Input, Buffer Output)
 	while (pos < *Input.size)
 	{
 		pos += ReadToken(&Input.block[pos], &len, &lit, &off);
+		if(pos > *Input.size)
+			return JAM_ERROR_CORRUPT;
 		if (off) // while offset isn't zero (end of lz77 code)
 		{
+			// make sure the literals and the match stay inside both buffers
+			if(lit < 0 || len < 0 || lit >= *Input.size - pos || lit > Output.capacity - out_pos || len > Output.capacity - out_pos - lit)
+				return JAM_ERROR_CORRUPT;
+			
 			// copy literals
 			FastCopy(&Output.block[out_pos], &Input.block[pos], lit);
 			out_pos += lit;
 			pos += lit;
 			
-			#ifndef NDEBUG
 			// make sure input is valid
-			if(pos >= *Input.size || out_pos - off < 0)
-				Error("Invalid lz77 token, caught attempt to read outside of the allocated buffer!");
-			#endif
+			if(off < 0 || out_pos - off < 0)
+				return JAM_ERROR_CORRUPT;
 			
 			// goto offset and copy matched data
 			FastCopyOverlap(&Output.block[out_pos], &Output.block[out_pos - off], len);
@@ -705,10 +718,13 @@ void Lz77::Decompress(Buffer Input, Buffer Output)
 		else
 		{
 			Index remainder = *Input.size - pos;
+			if(remainder > Output.capacity - out_pos)
+				return JAM_ERROR_CORRUPT;
 			FastCopy(&Output.block[out_pos], &Input.block[pos], remainder);
 			out_pos += remainder;
 			break;
 		}
 	}
 	*Output.size = out_pos;
+	return JAM_OK;
 }
@@ -14,16 +14,18 @@
 #include "divsufsort.hpp"
 #include "utils.hpp"
 #include "cyclichhm.hpp"
+#include "arena.hpp"
 
 class Lz77
 {
 public:
-	Lz77();
+	Lz77(Arena *Scratch);
 	~Lz77();
-	void Compress(Buffer Input, Buffer Output, Options Opt);
-	void Decompress(Buffer Input, Buffer Output);
+	int Compress(Buffer Input, Buffer Output, Options Opt);	// JAM_OK or JAM_ERROR_MEMORY
+	int Decompress(Buffer Input, Buffer Output);	// JAM_OK or JAM_ERROR_CORRUPT
 private:
 	Utils *Leb;
+	Arena *Workspace; // Suffix arrays, hash tables, and token buffers are borrowed from the instance arena
 	void FastCopy(unsigned char *dest, unsigned char *src, Index length);
 	void FastCopyOverlap(unsigned char *dest, unsigned char *src, Index length);
 	float Compressible(Index match, Index literal, Index offset);
@@ -1,7 +1,7 @@
 /*********************************************
 * Jampack - General purpose compression algorithm by Lucas Marsh (c) 2017
 * Jampack uses a hybrid of bwt, lz77, prefix modeling, and filters to achieve very high compression at reasonable decode speed and memory.
-* Encode memory is 6NK, decode memory is 6N by default (using all threads on a single block), or 6NK with multi-block enabled (using all threads with multiple parallel decoders).
+* Encode memory is 6NK, decode memory is 6N by default (2.5N with -l or when 6N doesn't fit) (using all threads on a single block), or 6NK with multi-block enabled (using all threads with multiple parallel decoders).
 **********************************************/
 #include "jampack.hpp"
 
@@ -22,8 +22,16 @@ Options:\n\
    -b#  Block size in MB            (1 to 1000) \n\
    -m#  Match finder                (0 = dedupe, 1 = positional context hash chain, 2 = anti-context suffix array)\n\
    -f#  Generic filters             (0 = disable, 1 = heuristic, 2 = brute force)\n\
+   -e#  Entropy coder layout        (0 = four byte-wise states, 1 = eight SIMD decoded lanes, 2 = static tANS)\n\
+   -x#  Sort transform              (0 = full BWT, 3 to 8 = limited context sort of that order)\n\
    -T   Enable multi-block decoding (Default disabled, uses all threads on one block instead of multiple blocks)\n\
-   -g   Enable GPU decoding         (Default disable)\n \n\
+   -g   Enable GPU decoding         (Default disable)\n\
+   -l   Low memory bwt decoding     (About 2.5N instead of 6N, slower, picked automatically when memory is short)\n\
+   -H   Huge page workspace         (2 MB aligned huge pages for the suffix arrays and inverse maps)\n\
+   -N#  NUMA placement              (0 = os default, 1 = pin workers to nodes and keep their blocks on the same node)\n\
+   -i   Append a block index        (Allows decoding a byte range with -s and -n)\n\
+   -s#  Range decode start offset   (In bytes, needs an archive made with -i)\n\
+   -n#  Range decode length         (In bytes, default is until the end)\n \n\
 Press 'enter' to continue", JAM_VERSION);
 	#else
 		printf("Jampack v%.2f by Lucas Marsh (c) 2017\n \n\
@@ -38,7 +46,15 @@ Options:\n\
    -b#  Block size in MB             (1 to 1000) \n\
    -m#  Match finder                 (0 = dedupe, 1 = positional context hash chain, 2 = anti-context suffix array)\n\
    -f#  Generic filters              (0 = disable, 1 = heuristic, 2 = brute force)\n\
-   -T   Enable limited memory decode (Default disabled, uses all threads on one block instead of multiple blocks)\n \n\
+   -e#  Entropy coder layout         (0 = four byte-wise states, 1 = eight SIMD decoded lanes, 2 = static tANS)\n\
+   -x#  Sort transform               (0 = full BWT, 3 to 8 = limited context sort of that order)\n\
+   -T   Enable limited memory decode (Default disabled, uses all threads on one block instead of multiple blocks)\n\
+   -l   Low memory bwt decoding      (About 2.5N instead of 6N, slower, picked automatically when memory is short)\n\
+   -H   Huge page workspace          (2 MB aligned huge pages for the suffix arrays and inverse maps)\n\
+   -N#  NUMA placement               (0 = os default, 1 = pin workers to nodes and keep their blocks on the same node)\n\
+   -i   Append a block index         (Allows decoding a byte range with -s and -n)\n\
+   -s#  Range decode start offset    (In bytes, needs an archive made with -i)\n\
+   -n#  Range decode length          (In bytes, default is until the end)\n \n\
 Press 'enter' to continue", JAM_VERSION);
 	#endif
 		getchar();
@@ -57,10 +73,19 @@ Press 'enter' to continue", JAM_VERSION);
 	Options Opt;
 	Opt.MatchFinder = 0;
 	Opt.Threads = MAX_THREADS;
+	Opt.SortThreads = 1;
 	Opt.BlockSize = DEFAULT_BLOCKSIZE;
 	Opt.Filters = 1;
 	Opt.Gpu = false;
 	Opt.Multiblock = true;
+	Opt.LowMemory = false;
+	Opt.HugePages = false;
+	Opt.Numa = 0;
+	Opt.EntropyMode = 0;
+	Opt.SortOrder = 0;
+	Opt.BlockIndex = false;
+	Opt.RangeStart = 0;
+	Opt.RangeLength = 0;
 	
 	int cur_opt = 4;
 	if (argc > 4)
@@ -79,8 +104,16 @@ Press 'enter' to continue", JAM_VERSION);
 						case 't': Opt.Threads = atoi(p+1); break;
 						case 'm': Opt.MatchFinder = atoi(p+1); break;
 						case 'f': Opt.Filters = atoi(p+1); break;
+						case 'e': Opt.EntropyMode = atoi(p+1); break;
+						case 'x': Opt.SortOrder = atoi(p+1); break;
 						case 'g': Opt.Gpu = true; break;
 						case 'T': Opt.Multiblock = false; break;
+						case 'l': Opt.LowMemory = true; break;
+						case 'H': Opt.HugePages = true; break;
+						case 'N': Opt.Numa = atoi(p+1); break;
+						case 'i': Opt.BlockIndex = true; break;
+						case 's': Opt.RangeStart = strtoull(p+1, NULL, 10); break;
+						case 'n': Opt.RangeLength = strtoull(p+1, NULL, 10); break;
 					}
 					p++;
 				}
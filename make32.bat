@@ -1,3 +1,3 @@
-g++ -std=c++14 -fopenmp -O3 ans.cpp bwt.cpp checksum.cpp cyclichhm.cpp divsufsort.cpp filters.cpp format.cpp jampack.cpp lpx.cpp lz77.cpp main.cpp model.cpp rank.cpp rle.cpp sys_detect.cpp utils.cpp -o Jampack_x86 -m32 -s -static
+g++ -std=c++14 -fopenmp -O3 ans.cpp arena.cpp bwt.cpp checksum.cpp cyclichhm.cpp divsufsort.cpp filters.cpp format.cpp jampack.cpp libjampack.cpp lpx.cpp lz77.cpp main.cpp model.cpp rank.cpp rans_lanes.cpp rle.cpp sys_detect.cpp tans.cpp utils.cpp -o Jampack_x86 -m32 -s -static
 PAUSE
 
@@ -1,2 +1,2 @@
-nvcc main.cpp jampack.cpp ans.cpp checksum.cpp cyclichhm.cpp divsufsort.cpp lz77.cpp lpx.cpp model.cpp rank.cpp rle.cpp format.cpp filters.cpp utils.cpp -x cu bwt.cpp sys_detect.cpp -L /usr/local/cuda/lib -lcudart -o Jampack_nv -Wno-deprecated-gpu-targets -ccbin "C:\Program Files (x86)\Microsoft Visual Studio\Shared\14.0\VC\bin" --compiler-options="-O2 -openmp"
+nvcc main.cpp jampack.cpp libjampack.cpp ans.cpp arena.cpp checksum.cpp cyclichhm.cpp divsufsort.cpp lz77.cpp lpx.cpp model.cpp rank.cpp rans_lanes.cpp rle.cpp tans.cpp format.cpp filters.cpp utils.cpp -x cu bwt.cpp sys_detect.cpp -L /usr/local/cuda/lib -lcudart -o Jampack_nv -Wno-deprecated-gpu-targets -ccbin "C:\Program Files (x86)\Microsoft Visual Studio\Shared\14.0\VC\bin" --compiler-options="-O2 -openmp"
 PAUSE
@@ -1,4 +1,61 @@
 #include "model.hpp"
+#include <immintrin.h>
+
+static const int ModelVectorWidth = 8; // Ints per AVX2 register, the SSE kernels take two steps per row
+
+/**
+* Count CDF entries above 'range', the entry below the first one above it is the symbol.
+* Padding entries hold ProbScale which is always above any range.
+*/
+TARGET_SSE41 static unsigned short RangeToSymSse(const int *CumFreqs, int Stride, unsigned int range)
+{
+	__m128i r = _mm_set1_epi32(range);
+	__m128i above = _mm_setzero_si128();
+	for(int i = 0; i < Stride; i += 4)
+		above = _mm_sub_epi32(above, _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)&CumFreqs[i]), r));
+	above = _mm_add_epi32(above, _mm_shuffle_epi32(above, _MM_SHUFFLE(1, 0, 3, 2)));
+	above = _mm_add_epi32(above, _mm_shuffle_epi32(above, _MM_SHUFFLE(2, 3, 0, 1)));
+	return Stride - _mm_cvtsi128_si32(above) - 1;
+}
+
+TARGET_AVX2 static unsigned short RangeToSymAvx2(const int *CumFreqs, int Stride, unsigned int range)
+{
+	__m256i r = _mm256_set1_epi32(range);
+	__m256i above = _mm256_setzero_si256();
+	for(int i = 0; i < Stride; i += 8)
+		above = _mm256_sub_epi32(above, _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)&CumFreqs[i]), r));
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(above), _mm256_extracti128_si256(above, 1));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return Stride - _mm_cvtsi128_si32(sum) - 1;
+}
+
+/**
+* CumFreqs += (MixRow - CumFreqs) >> Rate over the whole padded row, the first entry, the last entry, and the padding
+* are identical in both rows so they never move, which makes this bit exact with the scalar loop.
+*/
+TARGET_SSE41 static void MixSse(int *CumFreqs, const int *MixRow, int Stride, int Rate)
+{
+	for(int i = 0; i < Stride; i += 4)
+	{
+		__m128i cdf = _mm_loadu_si128((const __m128i*)&CumFreqs[i]);
+		__m128i mix = _mm_loadu_si128((const __m128i*)&MixRow[i]);
+		cdf = _mm_add_epi32(_mm_srai_epi32(_mm_sub_epi32(mix, cdf), Rate), cdf);
+		_mm_storeu_si128((__m128i*)&CumFreqs[i], cdf);
+	}
+}
+
+TARGET_AVX2 static void MixAvx2(int *CumFreqs, const int *MixRow, int Stride, int Rate)
+{
+	__m128i shift = _mm_cvtsi32_si128(Rate);
+	for(int i = 0; i < Stride; i += 8)
+	{
+		__m256i cdf = _mm256_loadu_si256((const __m256i*)&CumFreqs[i]);
+		__m256i mix = _mm256_loadu_si256((const __m256i*)&MixRow[i]);
+		cdf = _mm256_add_epi32(_mm256_sra_epi32(_mm256_sub_epi32(mix, cdf), shift), cdf);
+		_mm256_storeu_si256((__m256i*)&CumFreqs[i], cdf);
+	}
+}
 
 /**
 * Return row of element within a malloc'd 1D array as 2D
@@ -14,9 +71,11 @@ AdaptiveModel::AdaptiveModel(int Alpha)
 	if(Alpha <= 0)
 		Error("Alphabet size must be at least 1!");
 	*AlphabetSize = Alpha;
+	Stride = (Alpha + 1 + ModelVectorWidth - 1) & ~(ModelVectorWidth - 1);
+	Simd = GetSimdLevel();
 	
-	Mix = (int*)malloc((*AlphabetSize * (*AlphabetSize + 1)) * sizeof(int)); 
-	CumFreqs = (int*)malloc((*AlphabetSize + 1) * sizeof(int)); 
+	Mix = (int*)malloc((*AlphabetSize * Stride) * sizeof(int)); 
+	CumFreqs = (int*)malloc(Stride * sizeof(int)); 
 	
 	if(Mix == NULL) 
 		Error("Failed to allocate mixing table!");
@@ -43,6 +102,12 @@ unsigned int AdaptiveModel::SymToFreq(unsigned short sym)
 
 unsigned short AdaptiveModel::RangeToSym(unsigned int range)
 {
+	switch(Simd)
+	{
+		case SIMD_AVX2: return RangeToSymAvx2(CumFreqs, Stride, range);
+		case SIMD_SSE41: return RangeToSymSse(CumFreqs, Stride, range);
+	}
+	
 	// Linear search
 	for(int i = 0; i < *AlphabetSize; i++)
 	{
@@ -59,19 +124,12 @@ unsigned short AdaptiveModel::RangeToSym(unsigned int range)
 */
 void AdaptiveModel::Update(int symbol)
 {
-	/*
-	// Only for fixed sized alphabets
-	__m128i CDF1 = _mm_loadu_si128((__m128i*)&CumFreqs[0]);
-	__m128i CDF2 = _mm_loadu_si128((__m128i*)&CumFreqs[4]);
-	__m128i MIX1 = _mm_loadu_si128((__m128i*)&Mix[symbol][0]);
-	__m128i MIX2 = _mm_loadu_si128((__m128i*)&Mix[symbol][4]);
-	CDF1 = _mm_add_epi32(_mm_srai_epi32(_mm_sub_epi32(MIX1, CDF1), Rate), CDF1);
-	CDF2 = _mm_add_epi32(_mm_srai_epi32(_mm_sub_epi32(MIX2, CDF2), Rate), CDF2);
-	_mm_storeu_si128((__m128i *)&CumFreqs[0], CDF1);
-	_mm_storeu_si128((__m128i *)&CumFreqs[4], CDF2);
-	*/
-	
-	int *MixRow = Ptr1Dto2D(Mix, symbol, *AlphabetSize + 1); // *t+(row*width)+column
+	int *MixRow = Ptr1Dto2D(Mix, symbol, Stride); // *t+(row*width)+column
+	switch(Simd)
+	{
+		case SIMD_AVX2: MixAvx2(CumFreqs, MixRow, Stride, Rate); return;
+		case SIMD_SSE41: MixSse(CumFreqs, MixRow, Stride, Rate); return;
+	}
 	for(int i = 1; i < *AlphabetSize; i++)
         CumFreqs[i] += (MixRow[i] - CumFreqs[i]) >> Rate;
 }
@@ -94,12 +152,14 @@ void AdaptiveModel::Reset()
 	for(int i = 0; i < *AlphabetSize; i++) 
 		CumFreqs[i + 1] = CumFreqs[i] + freqs[i];
 	assert(CumFreqs[*AlphabetSize] == ProbScale);
+	for(int i = *AlphabetSize + 1; i < Stride; i++)
+		CumFreqs[i] = ProbScale;
 	free(freqs);
 	
 	for(int sym = 0; sym < *AlphabetSize; sym++)
 	{
 		int rm = 0;
-		int *MixRow = Ptr1Dto2D(Mix, sym, *AlphabetSize + 1);
+		int *MixRow = Ptr1Dto2D(Mix, sym, Stride);
 		for(int state = 0; state <= *AlphabetSize; state++)
 		{
 			MixRow[state] = rm;
@@ -109,6 +169,8 @@ void AdaptiveModel::Reset()
 				rm += 1;
 		}
 		assert(MixRow[*AlphabetSize] == ProbScale);
+		for(int state = *AlphabetSize + 1; state < Stride; state++)
+			MixRow[state] = ProbScale;
 	}
 }
 
@@ -148,10 +210,28 @@ unsigned int QuasiModel::SymToFreq(unsigned short sym)
 /**
 * Fast symbol to range, with binary searches we'd require up to ceil(log2(alpha))*n operations per block to get all symbols.
 * But with simple array mappings we need at most n+k operations per block, this is typically more efficient due to less operation dependencies.
+* The slot gives the symbol owning the start of a 16 range window, only symbols starting inside that window need to be stepped over.
 */
 unsigned short QuasiModel::RangeToSym(unsigned int range)
 {
-	return RangeToSymbol[range];
+	unsigned int sym = SlotToSymbol[range >> SlotShift];
+	while(CumFreqs[sym + 1] <= (int)range)
+		sym++;
+	return sym;
+}
+
+/**
+* Map every slot to the symbol that owns its first range
+*/
+void QuasiModel::BuildSlots()
+{
+	int sym = 0;
+	for(unsigned int slot = 0; slot < (ProbScale >> SlotShift); slot++)
+	{
+		while(CumFreqs[sym + 1] <= (int)(slot << SlotShift))
+			sym++;
+		SlotToSymbol[slot] = sym;
+	}
 }
 
 /**
@@ -193,10 +273,7 @@ void QuasiModel::Update(int symbol)
 		assert(CumFreqs[*AlphabetSize] == ProbScale);
 		
 		memset(Freqs, 0, *AlphabetSize * sizeof(int)); 
-		
-		for(int sym = 0; sym < *AlphabetSize; sym++)
-			for(unsigned int i = CumFreqs[sym]; i < CumFreqs[sym + 1]; i++)
-				RangeToSymbol[i] = sym;
+		BuildSlots();
 		
 		SEEN = 0;
 		EXP = (EXP < UPDATE_RATE) ? EXP << 1 : UPDATE_RATE;
@@ -228,8 +305,5 @@ void QuasiModel::Reset()
 
 	assert(CumFreqs[*AlphabetSize] == ProbScale);
 	memset(Freqs, 0, *AlphabetSize * sizeof(int)); 
-	
-	for(int sym = 0; sym < *AlphabetSize; sym++)
-        for(unsigned int i = CumFreqs[sym]; i < CumFreqs[sym + 1]; i++)
-            RangeToSymbol[i] = sym;
+	BuildSlots();
 }
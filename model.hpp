@@ -32,12 +32,15 @@ class AdaptiveModel
 	private:
 	inline int* Ptr1Dto2D(int *ptr, int x, int xMax);
 	int Rate = 5;
+	int Stride;		// CDF and mixing rows are padded with ProbScale to a multiple of the widest vector
+	int Simd;		// Kernel picked from GetSimdLevel() at construction
 	int *Mix;
 	int *CumFreqs;
 };
 
 /**
 * Quasi-static model performs alphabet-wise rescaling once per n-symbols
+* Symbol lookups go through a reduced precision slot table (4 KB instead of a full 128 KB range table) followed by a short forward scan.
 */
 class QuasiModel
 {
@@ -52,9 +55,11 @@ public:
 
     static const unsigned int ProbBits = 16;
     static const unsigned int ProbScale = 1 << ProbBits;
+	static const unsigned int SlotShift = 4; 	// Ranges per slot is 1 << SlotShift
 	int *Freqs;
 	int *CumFreqs;
-	unsigned short RangeToSymbol[ProbScale] = {0};
+	unsigned char SlotToSymbol[ProbScale >> SlotShift] = {0}; // Symbol owning the first range of every slot (alphabets are at most 129 symbols)
+	void BuildSlots();
 	void Update(int symbol);
 	void Reset();
 	unsigned int SymToLow(unsigned short sym);
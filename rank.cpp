@@ -4,9 +4,96 @@
 * SRC is equivalent to Move-to-Front but using a non-sequential output. 
 * This produces an almost identical freq spectrum as MTF does but it is ordered completely differently. 
 * This allows pretty much pure ranking to take place without worry of contextual distortion on local frequencies.
+*
+* The rank table is updated 16 ranks at a time, the encoder finds a symbol's rank with a vector compare
+* and both directions move the table by one rank with overlapping loads, so a high rank costs rank / 16 steps instead of rank.
+* The table is padded by a vector on both sides so the shifted loads never leave it.
+* Targets without SSE2 move the table one rank at a time.
 **********************************************/
 #include "rank.hpp"
 
+#ifdef HAVE_SSE2
+static const __m128i RankLanes = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+/**
+* Index of the lowest set bit, v is not 0
+*/
+static inline int LowestBit(unsigned int v)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, v);
+	return (int)i;
+#else
+	return __builtin_ctz(v);
+#endif
+}
+#endif
+
+/**
+* Rank of sym in R2S, the symbol must be in the table
+*/
+static inline int FindRank(const unsigned char *R2S, unsigned char sym)
+{
+#ifdef HAVE_SSE2
+	const __m128i v = _mm_set1_epi8((char)sym);
+	for(int k = 0; ; k += 16)
+	{
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&R2S[k]), v));
+		if(mask != 0)
+			return k + LowestBit(mask);
+	}
+#else
+	int k = 0;
+	while(R2S[k] != sym)
+		k++;
+	return k;
+#endif
+}
+
+/**
+* R2S[1 .. rank] = R2S[0 .. rank - 1], R2S[0] = sym. Blocks are moved from the top so every load sees the old table,
+* only the top block straddles the rank and needs a mask.
+*/
+static inline void MoveToFront(unsigned char *R2S, int rank, unsigned char sym)
+{
+#ifdef HAVE_SSE2
+	int k = rank & ~15;
+	__m128i old = _mm_loadu_si128((const __m128i*)&R2S[k]);
+	__m128i up = _mm_loadu_si128((const __m128i*)&R2S[k - 1]);
+	__m128i keep = _mm_cmpgt_epi8(RankLanes, _mm_set1_epi8((char)(rank - k)));
+	_mm_storeu_si128((__m128i*)&R2S[k], _mm_or_si128(_mm_and_si128(keep, old), _mm_andnot_si128(keep, up)));
+	for(k -= 16; k >= 0; k -= 16)
+		_mm_storeu_si128((__m128i*)&R2S[k], _mm_loadu_si128((const __m128i*)&R2S[k - 1]));
+#else
+	do
+		R2S[rank] = R2S[rank - 1];
+	while(0 < --rank);
+#endif
+	R2S[0] = sym;
+}
+
+/**
+* R2S[0 .. rank - 1] = R2S[1 .. rank], R2S[rank] = sym. Blocks are moved from the bottom so every load sees the old table,
+* only the last block straddles the rank and needs a mask.
+*/
+static inline void MoveToRank(unsigned char *R2S, int rank, unsigned char sym)
+{
+#ifdef HAVE_SSE2
+	int k = 0;
+	for(; k + 16 <= rank; k += 16)
+		_mm_storeu_si128((__m128i*)&R2S[k], _mm_loadu_si128((const __m128i*)&R2S[k + 1]));
+	__m128i old = _mm_loadu_si128((const __m128i*)&R2S[k]);
+	__m128i down = _mm_loadu_si128((const __m128i*)&R2S[k + 1]);
+	__m128i move = _mm_cmplt_epi8(RankLanes, _mm_set1_epi8((char)(rank - k)));
+	_mm_storeu_si128((__m128i*)&R2S[k], _mm_or_si128(_mm_and_si128(move, down), _mm_andnot_si128(move, old)));
+#else
+	for(int k = 0; k < rank; k++)
+		R2S[k] = R2S[k + 1];
+#endif
+	R2S[rank] = sym;
+}
+
 /**
 * Create a SortedMap[] of sorted frequencies of Freq[].
 * It repeatedly reduces the set of freqs by finding the largest freq, adding to SortedMap,
@@ -41,14 +128,13 @@ void Postcoder::GenerateSortedMap(int* Freq, unsigned char* SortedMap)
 /**
 * Encoding is fairly straight forward, perform MTF on current symbol and store the rank at bucket[sym]. 
 * This clusters ranks based on the symbol it refers to. 
+* The ranks are left in RankArray for the entropy coder to read directly.
 */
-void Postcoder::Encode(unsigned char* T, int* Freq, int len)
+void Postcoder::Encode(unsigned char* T, int* Freq, int len, unsigned char* RankArray)
 {
     int Bucket[256];
-    unsigned char SortedMap[256], S2R[256], R2S[256], sym, rank;
-	unsigned char *RankArray; 
-	if((RankArray = (unsigned char*)malloc(sizeof(unsigned char) * len)) == NULL) 
-		Error("Failed to alloc sorted rank array!");
+    unsigned char SortedMap[256], Table[16 + 256 + 16] = {0}, sym;
+	unsigned char *R2S = &Table[16];
 	memset(Freq, 0, 256 * sizeof(int));
 	
 	int UniqueSyms = 0;
@@ -56,10 +142,7 @@ void Postcoder::Encode(unsigned char* T, int* Freq, int len)
 	{
 		sym = T[i];
         if (Freq[sym] == 0) 
-		{
-            S2R[R2S[UniqueSyms] = sym] = UniqueSyms;
-            UniqueSyms++;
-        }
+            R2S[UniqueSyms++] = sym;
         Freq[sym]++;
     }
 
@@ -74,38 +157,33 @@ void Postcoder::Encode(unsigned char* T, int* Freq, int len)
     for (int i = 0; i < len; i++) 
 	{
         sym = T[i]; 
-		rank = S2R[sym]; 
+		int rank = FindRank(R2S, sym); 
         RankArray[Bucket[sym]++] = rank;
         if (rank > 0)
-		{
-            do
-			{
-                S2R[R2S[rank] = R2S[rank - 1]] = rank;
-            } while (0 < --rank);
-            S2R[R2S[0] = sym] = 0;
-        }
+			MoveToFront(R2S, rank, sym);
     }
-	memcpy(&T[0], &RankArray[0], len * sizeof(unsigned char));
-	free(RankArray);
 }
 
 /**
 * Decoding is a little weird, it performs an inverse MTF update while jumping through buckets to restore the original symbol.
 * The bucket rank implies the current symbol, and the symbol implies the next bucket to go to.
+* The symbols are written to T, RankArray is only read. Returns false if the frequencies don't describe a block of len symbols.
 */
-void Postcoder::Decode(unsigned char* RankArray, int* Freq, int len)
+bool Postcoder::Decode(unsigned char* RankArray, int* Freq, int len, unsigned char* T)
 {
     int Bucket[256], BucketEnd[256];
-    unsigned char SortedMap[256], R2S[256], sym, rank;
-	unsigned char *T;
-	if((T = (unsigned char*)malloc(sizeof(unsigned char) * len)) == NULL) 
-		Error("Failed to alloc inverse sorted rank array!");
+    unsigned char SortedMap[256], Table[16 + 256 + 16] = {0}, rank;
+	unsigned char *R2S = &Table[16];
 
 	int total = 0;
 	for(int i = 0; i < 256; i++)
+	{
+		if(Freq[i] < 0)
+			return false;
 		total += Freq[i];
+	}
 	if(total != len)
-		Error("Invalid decoder frequencies!");
+		return false;
 	
 	int UniqueSyms = 0;
 	for(int i = 0; i < 256; i++)
@@ -115,7 +193,7 @@ void Postcoder::Decode(unsigned char* RankArray, int* Freq, int len)
     GenerateSortedMap(Freq, SortedMap);
     for(int i = 0, BucketPos = 0; i < UniqueSyms; i++) 
 	{
-        sym = SortedMap[i];
+        int sym = SortedMap[i];
         R2S[RankArray[BucketPos]] = sym;
         Bucket[sym] = BucketPos + 1;
         BucketPos += Freq[sym];
@@ -129,11 +207,7 @@ void Postcoder::Decode(unsigned char* RankArray, int* Freq, int len)
 		{
             if (0 < (rank = RankArray[Bucket[sym]++])) 
 			{
-                int s = 0;
-                do
-                    R2S[s] = R2S[s + 1];
-                while(++s < rank);
-                R2S[rank] = sym;
+                MoveToRank(R2S, rank, sym); // sym is always at the front
                 sym = R2S[0];
             }
         }
@@ -146,6 +220,5 @@ void Postcoder::Decode(unsigned char* RankArray, int* Freq, int len)
             sym = R2S[0];
         }
     }
-	memcpy(&RankArray[0], &T[0], len * sizeof(unsigned char));
-	free(T);
+	return true;
 }
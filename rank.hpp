@@ -9,8 +9,8 @@
 class Postcoder 
 {
 public:
-	void Encode(unsigned char* T, int* Freq, int len);
-	void Decode(unsigned char* RankArray, int* Freq, int len);
+	void Encode(unsigned char* T, int* Freq, int len, unsigned char* RankArray); // T is left untouched, the ranks go to RankArray
+	bool Decode(unsigned char* RankArray, int* Freq, int len, unsigned char* T); // The symbols go to T, false on invalid frequencies
 private:
 	void GenerateSortedMap(int* Freq, unsigned char* SortedMap);
 };
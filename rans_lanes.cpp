@@ -0,0 +1,119 @@
+/*********************************************
+* Word-wise interleaved rANS lanes
+*
+* Refilling is branchless: the lanes which need a word are found with a compare and movemask,
+* the mask picks a shuffle that moves the next k words of the stream into those lanes in order.
+**********************************************/
+#include "rans_lanes.hpp"
+#include <immintrin.h>
+
+static uint32_t RefillPermute[256][8]; 	// AVX2: lane -> index of the stream word it takes
+static uint8_t RefillShuffle[16][16]; 	// SSE4.1: pshufb control for a half of 4 lanes
+static uint8_t RefillCount[256]; 	// Words consumed for a lane mask
+
+static bool BuildRefillTables()
+{
+	for(int mask = 0; mask < 256; mask++)
+	{
+		int k = 0;
+		for(int lane = 0; lane < 8; lane++)
+		{
+			RefillPermute[mask][lane] = k;
+			if(mask & (1 << lane))
+				k++;
+		}
+		RefillCount[mask] = k;
+	}
+	for(int mask = 0; mask < 16; mask++)
+	{
+		int k = 0;
+		for(int lane = 0; lane < 4; lane++)
+		{
+			RefillShuffle[mask][lane * 4 + 0] = (mask & (1 << lane)) ? (k * 2 + 0) : 0x80;
+			RefillShuffle[mask][lane * 4 + 1] = (mask & (1 << lane)) ? (k * 2 + 1) : 0x80;
+			RefillShuffle[mask][lane * 4 + 2] = 0x80;
+			RefillShuffle[mask][lane * 4 + 3] = 0x80;
+			if(mask & (1 << lane))
+				k++;
+		}
+	}
+	return true;
+}
+
+void RansLanesAdvance(uint32_t *State, const uint32_t *Low, const uint32_t *Freq, uint8_t **pptr, int Count)
+{
+	uint8_t *ptr = *pptr;
+	for(int lane = 0; lane < Count; lane++)
+	{
+		uint32_t x = State[lane];
+		x = Freq[lane] * (x >> RANS_WORD_BITS) + (x & ((1u << RANS_WORD_BITS) - 1)) - Low[lane];
+		if(x < RANS_WORD_L)
+		{
+			x = (x << 16) | ptr[0] | (ptr[1] << 8);
+			ptr += 2;
+		}
+		State[lane] = x;
+	}
+	*pptr = ptr;
+}
+
+static void AdvanceScalar(uint32_t *State, const uint32_t *Low, const uint32_t *Freq, uint8_t **pptr)
+{
+	RansLanesAdvance(State, Low, Freq, pptr, RANS_LANES);
+}
+
+TARGET_SSE41 static void AdvanceSse41(uint32_t *State, const uint32_t *Low, const uint32_t *Freq, uint8_t **pptr)
+{
+	const __m128i SlotMask = _mm_set1_epi32((1 << RANS_WORD_BITS) - 1);
+	for(int half = 0; half < RANS_LANES; half += 4)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)&State[half]);
+		__m128i low = _mm_loadu_si128((const __m128i*)&Low[half]);
+		__m128i freq = _mm_loadu_si128((const __m128i*)&Freq[half]);
+
+		// x = freq * (x >> 16) + (x & 0xffff) - low
+		__m128i slot = _mm_and_si128(x, SlotMask);
+		x = _mm_add_epi32(_mm_mullo_epi32(freq, _mm_srli_epi32(x, RANS_WORD_BITS)), _mm_sub_epi32(slot, low));
+
+		// Lanes below RANS_WORD_L shift in the next words of the stream
+		__m128i need = _mm_cmpeq_epi32(_mm_srli_epi32(x, 16), _mm_setzero_si128());
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(need));
+		__m128i words = _mm_loadl_epi64((const __m128i*)*pptr);
+		__m128i refill = _mm_shuffle_epi8(words, _mm_loadu_si128((const __m128i*)RefillShuffle[mask]));
+		x = _mm_blendv_epi8(x, _mm_or_si128(_mm_slli_epi32(x, 16), refill), need);
+
+		_mm_storeu_si128((__m128i*)&State[half], x);
+		*pptr += 2 * RefillCount[mask];
+	}
+}
+
+TARGET_AVX2 static void AdvanceAvx2(uint32_t *State, const uint32_t *Low, const uint32_t *Freq, uint8_t **pptr)
+{
+	__m256i x = _mm256_loadu_si256((const __m256i*)State);
+	__m256i low = _mm256_loadu_si256((const __m256i*)Low);
+	__m256i freq = _mm256_loadu_si256((const __m256i*)Freq);
+
+	__m256i slot = _mm256_and_si256(x, _mm256_set1_epi32((1 << RANS_WORD_BITS) - 1));
+	x = _mm256_add_epi32(_mm256_mullo_epi32(freq, _mm256_srli_epi32(x, RANS_WORD_BITS)), _mm256_sub_epi32(slot, low));
+
+	__m256i need = _mm256_cmpeq_epi32(_mm256_srli_epi32(x, 16), _mm256_setzero_si256());
+	int mask = _mm256_movemask_ps(_mm256_castsi256_ps(need));
+	__m256i words = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)*pptr));
+	__m256i refill = _mm256_permutevar8x32_epi32(words, _mm256_loadu_si256((const __m256i*)RefillPermute[mask]));
+	x = _mm256_blendv_epi8(x, _mm256_or_si256(_mm256_slli_epi32(x, 16), refill), need);
+
+	_mm256_storeu_si256((__m256i*)State, x);
+	*pptr += 2 * RefillCount[mask];
+}
+
+RansLaneKernel SelectRansLaneKernel()
+{
+	static const bool Ready = BuildRefillTables();
+	(void)Ready;
+	switch(GetSimdLevel())
+	{
+		case SIMD_AVX2: return AdvanceAvx2;
+		case SIMD_SSE41: return AdvanceSse41;
+		default: return AdvanceScalar;
+	}
+}
@@ -0,0 +1,64 @@
+/*********************************************
+* Word-wise interleaved rANS lanes
+*
+* 32-bit rANS states with 16-bit renormalization, values are dealt round-robin to RANS_LANES independent states.
+* Every state renormalizes at most once per value so a whole round of lanes can be advanced and refilled with vector code:
+* the decoder looks up all symbols of a round first (the models are shared, so that part stays sequential),
+* then advances all lanes at once and refills the lanes which dropped below RANS_WORD_L in lane order.
+*
+* The encoder is scalar and works in reverse like any rANS encoder, value i goes to lane i % RANS_LANES.
+**********************************************/
+#ifndef RANS_LANES_H
+#define RANS_LANES_H
+
+#include "format.hpp"
+
+#define RANS_LANES 		8
+#define RANS_WORD_L 		(1u << 16) 	// Lower bound of the normalization interval
+#define RANS_WORD_BITS 		16 		// Probability precision of every model feeding the lanes
+
+/**
+* Advance every lane by the symbol (low, freq) assigned to it and refill the lanes that need it
+*/
+typedef void (*RansLaneKernel)(uint32_t *State, const uint32_t *Low, const uint32_t *Freq, uint8_t **pptr);
+
+/**
+* Widest kernel the cpu supports, it reads up to 16 bytes ahead of the stream pointer
+*/
+RansLaneKernel SelectRansLaneKernel();
+
+/**
+* Portable kernel for the first 'Count' lanes, never reads past the words it consumes
+*/
+void RansLanesAdvance(uint32_t *State, const uint32_t *Low, const uint32_t *Freq, uint8_t **pptr, int Count);
+
+static inline void RansWordEncPut(uint32_t *r, uint8_t **pptr, uint32_t start, uint32_t freq)
+{
+	uint32_t x = *r;
+	if(x >= (freq << (32 - RANS_WORD_BITS))) // x_max = ((L >> scale_bits) << 16) * freq
+	{
+		*pptr -= 2;
+		(*pptr)[0] = (uint8_t)(x >> 0);
+		(*pptr)[1] = (uint8_t)(x >> 8);
+		x >>= 16;
+	}
+	*r = ((x / freq) << RANS_WORD_BITS) + (x % freq) + start;
+}
+
+static inline void RansWordEncFlush(uint32_t *r, uint8_t **pptr)
+{
+	*pptr -= 4;
+	(*pptr)[0] = (uint8_t)(*r >> 0);
+	(*pptr)[1] = (uint8_t)(*r >> 8);
+	(*pptr)[2] = (uint8_t)(*r >> 16);
+	(*pptr)[3] = (uint8_t)(*r >> 24);
+}
+
+static inline void RansWordDecInit(uint32_t *r, uint8_t **pptr)
+{
+	uint8_t *ptr = *pptr;
+	*r = (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+	*pptr += 4;
+}
+
+#endif // RANS_LANES_H
@@ -9,9 +9,39 @@
 class RLE
 {
 public:
-	void encode(unsigned char *in, unsigned short *out, int *len);
-	void decode(unsigned short *in, unsigned char *out, int *len, int real_len);
+	void Begin(unsigned char *out, int real_len);	// Start expanding a chunk of real_len bytes into out
+	inline void Put(unsigned short sym);		// Expand the next 16-bit symbol
+	bool End();					// Flush the last run, false if the symbols didn't expand to exactly the chunk length
 private:
-	inline int getMSB(unsigned int v);
+	unsigned char *Out;
+	int Pos;
+	int Len;
+	unsigned int Run;				// Bits of the pending zero run behind a leading 1
+	bool Failed;				// A symbol would have been written past the chunk, the rest are dropped
+	void Flush();
 };
-#endif // RLE_H
\ No newline at end of file
+
+inline void RLE::Put(unsigned short sym)
+{
+	if(sym > 1)
+	{
+		if(Run > 1)
+			Flush();
+		if(Pos >= Len) 
+		{
+			Failed = true;
+			return;
+		}
+		Out[Pos++] = sym - 1;
+	}
+	else
+	{
+		Run = (Run << 1) | sym;
+		if(Run > (unsigned int)Len + 1) 
+		{
+			Failed = true;
+			Run = 1;
+		}
+	}
+}
+#endif // RLE_H
@@ -2,6 +2,15 @@
 * Detects Hardware for Windows, Mac OS, UNIX, and NVidia accelerated platforms.
 **********************************************/
 #include "sys_detect.hpp"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef _WIN32
+	#include <unistd.h>
+#endif
+#ifdef __linux__
+	#include <sched.h>
+#endif
 
 namespace System
 {
@@ -9,6 +18,8 @@ namespace System
 	{
 		int64_t Memory = -1;
 		int64_t Cores = -1;
+		int Simd = -1;
+		int NumaNodes = -1;
 	};
 	
 	namespace Gpu
@@ -83,6 +94,146 @@ extern uint64_t GetAvailableMemory()
 		return System::Cpu::Memory;
 }
 
+/**
+* Query cpuid for SSE4.1 and AVX2, AVX2 also needs the os to save the upper halves of the ymm registers (xgetbv)
+*/
+extern int GetSimdLevel()
+{
+	if(System::Cpu::Simd == -1)
+	{
+		int Level = SIMD_NONE;
+		unsigned int Leaf1[4] = {0}, Leaf7[4] = {0};
+		unsigned long long Xcr0 = 0;
+	#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		int r[4];
+		__cpuid(r, 0);
+		int MaxLeaf = r[0];
+		__cpuid(r, 1); 
+		memcpy(Leaf1, r, sizeof(r));
+		if(MaxLeaf >= 7) { __cpuidex(r, 7, 0); memcpy(Leaf7, r, sizeof(r)); }
+		if(Leaf1[2] & (1 << 27)) Xcr0 = _xgetbv(0);
+	#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		unsigned int MaxLeaf = __get_cpuid_max(0, NULL);
+		__get_cpuid(1, &Leaf1[0], &Leaf1[1], &Leaf1[2], &Leaf1[3]);
+		if(MaxLeaf >= 7) __cpuid_count(7, 0, Leaf7[0], Leaf7[1], Leaf7[2], Leaf7[3]);
+		if(Leaf1[2] & (1 << 27)) 
+		{
+			unsigned int lo, hi;
+			__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+			Xcr0 = ((unsigned long long)hi << 32) | lo;
+		}
+	#endif
+		if(Leaf1[2] & (1 << 19)) // SSE4.1
+			Level = SIMD_SSE41;
+		if(Level == SIMD_SSE41 && (Leaf7[1] & (1 << 5)) && (Xcr0 & 6) == 6) // AVX2 with xmm and ymm state enabled
+			Level = SIMD_AVX2;
+		System::Cpu::Simd = Level;
+	}
+	return System::Cpu::Simd;
+}
+
+/**
+* NUMA nodes the kernel exposes in sysfs, 1 when there is no NUMA information (and on other platforms)
+*/
+extern int GetNumaNodes()
+{
+	if(System::Cpu::NumaNodes == -1)
+	{
+		int Nodes = 0;
+	#ifdef __linux__
+		char path[64];
+		while(1)
+		{
+			snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", Nodes);
+			FILE *f = fopen(path, "r");
+			if(f == NULL)
+				break;
+			fclose(f);
+			Nodes++;
+		}
+	#endif
+		System::Cpu::NumaNodes = (Nodes > 0) ? Nodes : 1;
+	}
+	return System::Cpu::NumaNodes;
+}
+
+/**
+* Pin the calling thread to the cpus of a NUMA node (the cpulist is a list of ranges like "0-7,16-23"), 
+* threads it starts later inherit the mask. Returns false if the node or affinity isn't available.
+*/
+extern bool BindToNumaNode(int Node)
+{
+#ifdef __linux__
+	char path[64], list[4096];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", Node);
+	FILE *f = fopen(path, "r");
+	if(f == NULL)
+		return false;
+	bool Read = fgets(list, sizeof(list), f) != NULL;
+	fclose(f);
+	if(!Read)
+		return false;
+	
+	cpu_set_t Set;
+	CPU_ZERO(&Set);
+	int Cpus = 0;
+	char *p = list;
+	while(*p >= '0' && *p <= '9')
+	{
+		int first = (int)strtol(p, &p, 10), last = first;
+		if(*p == '-')
+			last = (int)strtol(p + 1, &p, 10);
+		for(int c = first; c <= last && c < CPU_SETSIZE; c++, Cpus++)
+			CPU_SET(c, &Set);
+		if(*p == ',')
+			p++;
+	}
+	return Cpus > 0 && sched_setaffinity(0, sizeof(Set), &Set) == 0;
+#else
+	(void)Node;
+	return false;
+#endif
+}
+
+/**
+* Threads of the OpenMP pool outlive the region which pinned them, so whoever pins a thread keeps its old mask to put back afterwards
+*/
+extern void *SaveAffinity()
+{
+#ifdef __linux__
+	cpu_set_t *Set = (cpu_set_t*)malloc(sizeof(cpu_set_t));
+	if(Set != NULL && sched_getaffinity(0, sizeof(cpu_set_t), Set) != 0)
+	{
+		free(Set);
+		Set = NULL;
+	}
+	return Set;
+#else
+	return NULL;
+#endif
+}
+
+extern void RestoreAffinity(void *Saved)
+{
+#ifdef __linux__
+	if(Saved != NULL)
+		sched_setaffinity(0, sizeof(cpu_set_t), (cpu_set_t*)Saved);
+#endif
+	free(Saved);
+}
+
+/**
+* Give up the cpu for a while, Windows sleeps in milliseconds so anything shorter becomes 1 ms there
+*/
+extern void SleepMicroseconds(unsigned int Microseconds)
+{
+#ifdef _WIN32
+	Sleep((Microseconds + 999) / 1000);
+#else
+	usleep(Microseconds);
+#endif
+}
+
 #ifdef __CUDACC__
 extern bool CheckCudaSupport()
 {
@@ -10,6 +10,7 @@
 
 #ifdef _WIN32
 	#include <windows.h>
+	#include <intrin.h>
 #elif MACOS
 	#include <sys/param.h>
 	#include <sys/sysctl.h>
@@ -17,10 +18,28 @@
 	#include <unistd.h>
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#include <cpuid.h>
+#endif
+
 extern uint64_t GetCoreCount();
 
 extern uint64_t GetAvailableMemory();
 
+enum SimdLevel { SIMD_NONE, SIMD_SSE41, SIMD_AVX2 }; // Widest vector extension the cpu and os both support
+
+extern int GetSimdLevel();
+
+extern int GetNumaNodes();
+
+extern bool BindToNumaNode(int Node);
+
+extern void *SaveAffinity(); // Cpu mask of the calling thread, NULL where affinity isn't supported
+
+extern void RestoreAffinity(void *Saved); // Put a mask from SaveAffinity back on the calling thread and release it
+
+extern void SleepMicroseconds(unsigned int Microseconds);
+
 #ifdef __CUDACC__
 extern bool CheckCudaSupport();
 
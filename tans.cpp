@@ -0,0 +1,196 @@
+/*********************************************
+* Static tANS (FSE style table coder)
+*
+* The states of the table are dealt to the symbols by stepping through it with an odd stride,
+* which spreads every symbol evenly. State x of a symbol with n states emits TANS_TABLE_LOG - log2(x) bits
+* for x in [n, 2n), the encoder tables are derived from the same spread so both sides agree on every transition.
+**********************************************/
+#include "tans.hpp"
+
+static inline int HighBit(unsigned int v)
+{
+	int n = -1;
+	while(v)
+	{
+		v >>= 1;
+		n++;
+	}
+	return n;
+}
+
+/**
+* Symbol owning every state of the table
+*/
+static void SpreadSymbols(const int *Norm, uint16_t *Spread)
+{
+	const int Mask = TANS_TABLE_SIZE - 1;
+	const int Step = (TANS_TABLE_SIZE >> 1) + (TANS_TABLE_SIZE >> 3) + 3;
+	int pos = 0;
+	for(int s = 0; s < TANS_SYMBOLS; s++)
+	{
+		for(int i = 0; i < Norm[s]; i++)
+		{
+			Spread[pos] = s;
+			pos = (pos + Step) & Mask;
+		}
+	}
+}
+
+/**
+* Rounded scaling, the rounding error is then settled on the largest counts which lose the least by it
+*/
+void TansNormalize(const int *Freq, int Total, int *Norm)
+{
+	int sum = 0;
+	for(int s = 0; s < TANS_SYMBOLS; s++)
+	{
+		Norm[s] = 0;
+		if(Freq[s] > 0)
+		{
+			Norm[s] = (int)(((uint64_t)Freq[s] * TANS_TABLE_SIZE + (Total >> 1)) / Total);
+			if(Norm[s] == 0)
+				Norm[s] = 1;
+		}
+		sum += Norm[s];
+	}
+
+	while(sum != TANS_TABLE_SIZE)
+	{
+		int max = 0;
+		for(int s = 1; s < TANS_SYMBOLS; s++)
+			if(Norm[s] > Norm[max])
+				max = s;
+		if(sum < TANS_TABLE_SIZE)
+		{
+			Norm[max] += TANS_TABLE_SIZE - sum;
+			sum = TANS_TABLE_SIZE;
+		}
+		else
+		{
+			Norm[max]--;
+			sum--;
+		}
+	}
+}
+
+int TansEncode(const uint16_t *Syms, int Count, const int *Norm, uint8_t *out)
+{
+	struct Transform
+	{
+		uint32_t DeltaBits;	// (bits << 16) - (n << bits), adding the state gives the bits to emit in the top half
+		int DeltaState;		// Start of the symbol's states in StateTable minus n
+	};
+	Transform Symbol[TANS_SYMBOLS];
+	uint16_t Spread[TANS_TABLE_SIZE];
+	uint16_t StateTable[TANS_TABLE_SIZE];
+	int Cumul[TANS_SYMBOLS];
+
+	SpreadSymbols(Norm, Spread);
+	for(int s = 0, total = 0; s < TANS_SYMBOLS; s++)
+	{
+		int n = Norm[s];
+		Cumul[s] = total;
+		if(n == 1)
+		{
+			Symbol[s].DeltaBits = (TANS_TABLE_LOG << 16) - TANS_TABLE_SIZE;
+			Symbol[s].DeltaState = total - 1;
+		}
+		else if(n > 1)
+		{
+			int bits = TANS_TABLE_LOG - HighBit(n - 1);
+			Symbol[s].DeltaBits = (bits << 16) - (n << bits);
+			Symbol[s].DeltaState = total - n;
+		}
+		total += n;
+	}
+	for(int u = 0; u < TANS_TABLE_SIZE; u++)
+		StateTable[Cumul[Spread[u]]++] = TANS_TABLE_SIZE + u;
+
+	uint8_t *ptr = out;
+	memset(ptr, 0, TANS_PAD);
+	ptr += TANS_PAD;
+	uint64_t bits = 0;
+	unsigned int n = 0;
+
+	uint32_t State[TANS_STATES];
+	for(int k = 0; k < TANS_STATES; k++)
+		State[k] = TANS_TABLE_SIZE;
+	for(int i = Count - 1; i >= 0; i--) // working in reverse, symbol i belongs to state i % TANS_STATES
+	{
+		uint32_t *x = &State[i % TANS_STATES];
+		const Transform t = Symbol[Syms[i]];
+		unsigned int nb = (*x + t.DeltaBits) >> 16;
+		bits |= (uint64_t)(*x & ((1u << nb) - 1)) << n;
+		n += nb;
+		*x = StateTable[(*x >> nb) + t.DeltaState];
+
+		memcpy(ptr, &bits, sizeof(uint64_t));
+		ptr += n >> 3;
+		bits >>= n & ~7;
+		n &= 7;
+	}
+
+	for(int k = 0; k < TANS_STATES; k++) // The decoder starts from the last state written
+	{
+		bits |= (uint64_t)(State[k] - TANS_TABLE_SIZE) << n;
+		n += TANS_TABLE_LOG;
+		memcpy(ptr, &bits, sizeof(uint64_t));
+		ptr += n >> 3;
+		bits >>= n & ~7;
+		n &= 7;
+	}
+	bits |= (uint64_t)1 << n; // End mark, tells the decoder where the bits start
+	memcpy(ptr, &bits, sizeof(uint64_t));
+	ptr += (n + 8) >> 3;
+
+	return ptr - out;
+}
+
+bool TansDecoder::Build(const int *Norm)
+{
+	uint16_t Spread[TANS_TABLE_SIZE];
+	unsigned int Next[TANS_SYMBOLS];
+
+	int sum = 0;
+	for(int s = 0; s < TANS_SYMBOLS; s++)
+	{
+		if(Norm[s] < 0 || Norm[s] > TANS_TABLE_SIZE)
+			return false;
+		sum += Norm[s];
+		Next[s] = Norm[s];
+	}
+	if(sum != TANS_TABLE_SIZE)
+		return false;
+
+	SpreadSymbols(Norm, Spread);
+	for(int u = 0; u < TANS_TABLE_SIZE; u++)
+	{
+		int s = Spread[u];
+		unsigned int x = Next[s]++;
+		int nb = TANS_TABLE_LOG - HighBit(x);
+		Table[u].Symbol = s;
+		Table[u].Bits = nb;
+		Table[u].NewState = (x << nb) - TANS_TABLE_SIZE;
+	}
+	return true;
+}
+
+bool TansDecoder::Begin(const uint8_t *begin, const uint8_t *end)
+{
+	if(end - begin < TANS_PAD + 1 || end[-1] == 0)
+		return false;
+	Failed = false;
+	Start = begin;
+	Ptr = end - sizeof(uint64_t);
+	memcpy(&Container, Ptr, sizeof(uint64_t));
+	Consumed = 8 - HighBit(end[-1]);
+	for(int k = TANS_STATES - 1; k >= 0; k--)
+		State[k] = Read(TANS_TABLE_LOG);
+	Reload();
+	return true;
+}
+
+bool TansDecoder::End()
+{
+	return !Failed && (Ptr - Start) * 8 + 64 - Consumed == TANS_PAD * 8;
+}
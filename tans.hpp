@@ -0,0 +1,87 @@
+/*********************************************
+* Static tANS (FSE style table coder)
+*
+* The counts of a chunk are normalized to TANS_TABLE_SIZE and sent in front of its stream, both sides build the
+* same state table from them so nothing adapts while coding: decoding a symbol is a table lookup and a bit read.
+* Two states are interleaved (symbol i uses state i % TANS_STATES) so consecutive lookups don't depend on each other.
+*
+* The encoder works in reverse and writes its bits forward behind TANS_PAD zero bytes, closing with a 1 bit,
+* the decoder reads them backward from the end of the stream with a 64-bit container.
+**********************************************/
+#ifndef TANS_H
+#define TANS_H
+
+#include "format.hpp"
+
+#define TANS_TABLE_LOG 		12
+#define TANS_TABLE_SIZE 	(1 << TANS_TABLE_LOG)
+#define TANS_SYMBOLS 		257 	// rle0 symbols, rank + 1 and the two run bits
+#define TANS_STATES 		2
+#define TANS_PAD 		8 	// Zero bytes ahead of the bits so the backward reader never loads before the stream
+
+/**
+* Scale Freq (summing to Total) to Norm summing to TANS_TABLE_SIZE, every symbol present keeps at least one state
+*/
+void TansNormalize(const int *Freq, int Total, int *Norm);
+
+/**
+* Encode Count symbols with the table of Norm, returns the size of the stream, out needs TANS_PAD + 8 bytes more than the bits
+*/
+int TansEncode(const uint16_t *Syms, int Count, const int *Norm, uint8_t *out);
+
+class TansDecoder
+{
+	public:
+	bool Build(const int *Norm);				// False if Norm doesn't sum to TANS_TABLE_SIZE
+	bool Begin(const uint8_t *begin, const uint8_t *end);	// Read the final states of the encoder, false if the stream is too short or has no end mark
+	inline void Reload();					// Refill the container, room for 4 symbols afterwards
+	inline unsigned short Next(int k);			// Decode the next symbol of state k
+	bool End();						// Check that the stream was consumed exactly
+
+	private:
+	struct Entry
+	{
+		uint16_t NewState;
+		uint16_t Symbol;
+		uint8_t Bits;
+	};
+	Entry Table[TANS_TABLE_SIZE];
+
+	const uint8_t *Start;						// First byte of the stream, the padding
+	const uint8_t *Ptr;
+	uint64_t Container;
+	unsigned int Consumed;					// Bits of the container already read, from the top
+	unsigned int State[TANS_STATES];
+	bool Failed;						// A refill ran past the start of the stream, the container stays on its first bytes
+
+	inline unsigned int Read(unsigned int nb);
+};
+
+inline unsigned int TansDecoder::Read(unsigned int nb)
+{
+	unsigned int v = (unsigned int)(((Container << Consumed) >> 1) >> (63 - nb));
+	Consumed += nb;
+	return v;
+}
+
+inline void TansDecoder::Reload()
+{
+	const uint8_t *p = Ptr - (Consumed >> 3);
+	if(p < Start)
+	{
+		Failed = true;
+		p = Start;
+	}
+	Ptr = p;
+	Consumed &= 7;
+	memcpy(&Container, Ptr, sizeof(uint64_t));
+}
+
+inline unsigned short TansDecoder::Next(int k)
+{
+	Entry e = Table[State[k]];
+	State[k] = e.NewState + Read(e.Bits);
+	return e.Symbol;
+}
+
+#endif // TANS_H
@@ -68,7 +68,7 @@ Index Utils::EncodeLeb128(Index val, unsigned char *buf)
 }
 
 /**
-* Read compressed integer in LEB128 with carry. Returns new position in the buffer and value.
+* Read compressed integer in LEB128 with carry. Returns new position in the buffer and value, the value is -1 if the code is too long.
 */
 Index Utils::DecodeLeb128(Index *valptr, unsigned char *buf)
 {
@@ -76,10 +76,11 @@ Index Utils::DecodeLeb128(Index *valptr, unsigned char *buf)
 	Index val = 0;
 	while((buf[d] & 0x80) == 0)
 	{
-		#ifndef NDEBUG
-		if(d > 4) 
-			Error("LEB decoder tried to load a value bigger than the type supports!");
-		#endif
+		if(d > 4) // Bigger than the type supports, only corrupt data gets here, hand back an invalid value for the caller to reject
+		{
+			*valptr = -1;
+			return d;
+		}
 		val = (val << 7) | buf[d];
 		d++;
 	}
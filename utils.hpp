@@ -41,7 +41,7 @@ class Utils
 	Index EncodeLeb128(Index val, unsigned char *buf);
 
 	/**
-	* Read compressed integer in LEB128 with carry. Returns new position in the buffer and value.
+	* Read compressed integer in LEB128 with carry. Returns new position in the buffer and value, the value is -1 if the code is too long.
 	*/
 	Index DecodeLeb128(Index *valptr, unsigned char *buf);
 